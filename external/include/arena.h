@@ -67,10 +67,13 @@ typedef Arena arena_t;
 Region *new_region(size_t capacity);
 void free_region(Region *r);
 
-// TODO: snapshot/rewind capability for the arena
-// - Snapshot should be combination of a->end and a->end->count.
-// - Rewinding should be restoring a->end and a->end->count from the snapshot and
-// setting count-s of all the Region-s after the remembered a->end to 0.
+// Snapshot of how much of an arena is in use. Rewinding to it gives back
+// everything allocated since in one go, keeping the regions around for reuse.
+typedef struct {
+    Region *end;
+    size_t count;
+} Arena_Mark;
+
 void *arena_alloc(Arena *a, size_t size_bytes);
 void *arena_realloc(Arena *a, void *oldptr, size_t oldsz, size_t newsz);
 char *arena_strdup(Arena *a, const char *cstr);
@@ -79,6 +82,8 @@ void *arena_memdup(Arena *a, void *data, size_t size);
 char *arena_sprintf(Arena *a, const char *format, ...);
 #endif // ARENA_NOSTDIO
 
+Arena_Mark arena_snapshot(Arena *a);
+void arena_rewind(Arena *a, Arena_Mark m);
 void arena_reset(Arena *a);
 void arena_free(Arena *a);
 
@@ -138,6 +143,11 @@ Region *new_region(size_t capacity)
     size_t size_bytes = sizeof(Region) + sizeof(uintptr_t) * capacity;
     Region *r = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
     ARENA_ASSERT(r != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+    // Only a hint. Regions large enough get backed by huge pages where the
+    // kernel allows it, fewer TLB misses when walking big arrays.
+    madvise(r, size_bytes, MADV_HUGEPAGE);
+#endif
     r->next = NULL;
     r->count = 0;
     r->capacity = capacity;
@@ -282,6 +292,35 @@ char *arena_sprintf(Arena *a, const char *format, ...)
 }
 #endif // ARENA_NOSTDIO
 
+Arena_Mark arena_snapshot(Arena *a)
+{
+    Arena_Mark m;
+    if (a->end == NULL) {
+        // Nothing allocated yet, rewinding to this resets the arena.
+        m.end = NULL;
+        m.count = 0;
+    } else {
+        m.end = a->end;
+        m.count = a->end->count;
+    }
+    return m;
+}
+
+void arena_rewind(Arena *a, Arena_Mark m)
+{
+    if (m.end == NULL) {
+        arena_reset(a);
+        return;
+    }
+
+    m.end->count = m.count;
+    for (Region *r = m.end->next; r != NULL; r = r->next) {
+        r->count = 0;
+    }
+
+    a->end = m.end;
+}
+
 void arena_reset(Arena *a)
 {
     for (Region *r = a->begin; r != NULL; r = r->next) {
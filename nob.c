@@ -1,24 +1,64 @@
 #define NOB_IMPLEMENTATION
 #include "./external/include/nob.h"
 
+// Sources of the simulation core, shared by every target. None of these may
+// call into raylib, so the headless targets link without it.
+static const char *core_sources[] = {
+    "src/world.c",
+    "src/pool.c",
+    "src/snapshot.c",
+    "src/recording.c",
+    "src/prof.c",
+    "src/sim.c",
+    "src/sched.c",
+    "src/brush.c",
+    "src/stream.c",
+    "src/colors.c",
+};
+
+static void cmd_append_common(Nob_Cmd *cmd)
+{
+    nob_cmd_append(cmd, "cc", "-O3");
+    nob_cmd_append(cmd, "-Wall", "-Wextra");
+    nob_cmd_append(cmd, "-pthread");
+    nob_cmd_append(cmd, "-Iexternal/include/raylib");
+    nob_cmd_append(cmd, "-Iexternal/include");
+}
+
+static bool build_main(Nob_Cmd *cmd)
+{
+    cmd->count = 0;
+    cmd_append_common(cmd);
+    nob_cmd_append(cmd, "-o", "build/main");
+    nob_cmd_append(cmd, "src/main.c");
+    nob_da_append_many(cmd, core_sources, NOB_ARRAY_LEN(core_sources));
+    nob_cmd_append(cmd, "-Wl,-rpath=../external/lib/raylib");
+    nob_cmd_append(cmd, "-L./external/lib/raylib");
+    nob_cmd_append(cmd, "-l:libraylib.a", "-lm");
+    return nob_cmd_run_sync(*cmd);
+}
+
+// Headless benchmark, no raylib and no window.
+static bool build_bench(Nob_Cmd *cmd)
+{
+    cmd->count = 0;
+    cmd_append_common(cmd);
+    nob_cmd_append(cmd, "-o", "build/bench");
+    nob_cmd_append(cmd, "src/bench.c");
+    nob_da_append_many(cmd, core_sources, NOB_ARRAY_LEN(core_sources));
+    nob_cmd_append(cmd, "-lm");
+    return nob_cmd_run_sync(*cmd);
+}
+
 int main(int argc, char **argv)
 {
     NOB_GO_REBUILD_URSELF(argc, argv);
 
+    if (!nob_mkdir_if_not_exists("build")) return 1;
+
     Nob_Cmd cmd = {0};
-    nob_cmd_append(&cmd, "cc", "-O3");
-    nob_cmd_append(&cmd, "-Wall", "-Wextra");
-    nob_cmd_append(&cmd, "-Iexternal/include/raylib");
-    nob_cmd_append(&cmd, "-Iexternal/include");
-    nob_cmd_append(&cmd, "-o", "build/main");
-    nob_cmd_append(&cmd, "src/main.c");
-    nob_cmd_append(&cmd, "-Wl,-rpath=../external/lib/raylib");
-    nob_cmd_append(&cmd, "-L./external/lib/raylib");
-    nob_cmd_append(&cmd, "-l:libraylib.a", "-lm");
-    if (!nob_cmd_run_sync(cmd))
-    {
-        return 1;
-    }
+    if (!build_main(&cmd)) return 1;
+    if (!build_bench(&cmd)) return 1;
 
     return 0;
 }
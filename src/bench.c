@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NOB_IMPLEMENTATION
+#include "nob.h"
+
+#include "world.h"
+#include "snapshot.h"
+#include "recording.h"
+#include "prof.h"
+#include "pool.h"
+#include "colors.h"
+
+#define BENCH_DEFAULT_WIDTH  640
+#define BENCH_DEFAULT_HEIGHT 360
+#define BENCH_DEFAULT_TICKS  1000
+
+typedef void (*Scene_Setup)(World *world);
+
+typedef struct Scene {
+    const char *name;
+    Scene_Setup setup;
+    // Snapshot to start from instead of running `setup` on an empty world.
+    const char *path;
+    // Session to replay, replaces both the world setup and -ticks.
+    Recording *recording;
+} Scene;
+
+typedef struct Scenes {
+    Scene *items;
+    size_t count;
+    size_t capacity;
+} Scenes;
+
+static void world_fill_rect(World *world, size_t x0, size_t y0, size_t x1, size_t y1, Particle_Type type)
+{
+    for (size_t y = y0; y < y1 && y < world->height; ++y) {
+        for (size_t x = x0; x < x1 && x < world->width; ++x) {
+            world_set_type(world, x, y, type);
+        }
+    }
+}
+
+// A tall block of sand in the middle of the world that collapses into a pile.
+static void scene_sand_pile(World *world)
+{
+    size_t w = world->width, h = world->height;
+    world_fill_rect(world, w*3/8, h/16, w*5/8, h/2, PT_SAND);
+}
+
+// A stone tank with a column of water poured into one side of it.
+static void scene_water_tank(World *world)
+{
+    size_t w = world->width, h = world->height;
+    world_fill_rect(world, w/8, h - h/16, w - w/8, h, PT_STONE);
+    world_fill_rect(world, w/8, h/4, w/8 + 4, h, PT_STONE);
+    world_fill_rect(world, w - w/8 - 4, h/4, w - w/8, h, PT_STONE);
+    world_fill_rect(world, w/8 + 4, h/4, w/2, h - h/16, PT_WATER);
+}
+
+// A layer of water with a block of sand dropped on top, sand sinks through.
+static void scene_sand_on_water(World *world)
+{
+    size_t w = world->width, h = world->height;
+    world_fill_rect(world, 0, h*5/8, w, h, PT_WATER);
+    world_fill_rect(world, w/4, h/8, w*3/4, h*3/8, PT_SAND);
+}
+
+// Sand scattered over the top half of the world, one cell in sixteen, that
+// rains down onto the floor. Mostly empty space, all of it awake.
+static void scene_sand_rain(World *world)
+{
+    for (size_t y = 0; y < world->height / 2; ++y) {
+        world_paint_span(world, y, 0, world->width, PT_SAND, 128 / 16);
+    }
+    world_wake_rect(world, 0, 0, world->width, world->height);
+}
+
+static Scene scenes[] = {
+    { .name = "sand_pile",     .setup = scene_sand_pile     },
+    { .name = "water_tank",    .setup = scene_water_tank    },
+    { .name = "sand_on_water", .setup = scene_sand_on_water },
+    { .name = "sand_rain",     .setup = scene_sand_rain     },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+typedef struct Bench_Config {
+    size_t width;
+    size_t height;
+    size_t ticks;
+    uint64_t seed;
+    size_t threads; // 0 runs the serial sweep
+    bool deterministic;
+    World_Engine engine;
+    bool sweep_all;
+    // Run this many worlds of every scene side by side instead of one, with
+    // seeds counting up from the scene's own, on a pool of `jobs` threads.
+    size_t batch;
+    size_t jobs;
+    // Time converting the final grid of every scene to pixels.
+    bool colors;
+    // Directory to write the starting world of every scene to, as raw
+    // snapshots that can be run again with -load.
+    const char *save_dir;
+} Bench_Config;
+
+// The starting world of a scene, set up for `config`. The seed is the
+// scene's own plus `seed_offset`. Returns NULL if a snapshot can not be
+// loaded.
+static World *scene_world(Scene *scene, Bench_Config config, uint64_t seed_offset, size_t *ticks)
+{
+    *ticks = config.ticks;
+
+    World *world = NULL;
+    if (scene->recording) {
+        world = world_new(scene->recording->width, scene->recording->height);
+        world_set_seed(world, scene->recording->seed + seed_offset);
+        *ticks = scene->recording->ticks;
+    } else if (scene->path) {
+        uint64_t start = now_ns();
+        world = world_load(scene->path);
+        if (!world) return NULL;
+        if (seed_offset == 0) {
+            nob_log(NOB_INFO, "loaded %s (%zux%zu) in %.3f ms", scene->path, world->width, world->height, (now_ns() - start) / 1e6);
+        }
+        world_set_seed(world, world->seed + seed_offset);
+    } else {
+        world = world_new(config.width, config.height);
+        world_set_seed(world, config.seed + seed_offset);
+    }
+    world->engine = config.engine;
+    world->sweep_occupied = !config.sweep_all;
+    if (config.threads > 0) {
+        world->parallel = true;
+        world->deterministic = config.deterministic;
+        world_set_threads(world, config.threads);
+    }
+    if (scene->setup) scene->setup(world);
+    return world;
+}
+
+// Turn the whole grid into pixels with every colour kernel the CPU supports,
+// unscaled and at twice the size, and report how fast each one goes. Bytes
+// count the planes read and the pixels written. Every kernel has to produce
+// the same pixels as the scalar one.
+static void bench_colors(World *world)
+{
+    World_Rect all = { .width = world->width, .height = world->height };
+    size_t cells = world->width * world->height;
+    Color *pixels = malloc(cells * 4 * sizeof(Color));
+    Color *expected = malloc(cells * 4 * sizeof(Color));
+    assert(pixels && expected && "Could not allocate pixels");
+
+    Colors_Kernel previous = colors_kernel();
+    for (size_t scale = 1; scale <= 2; ++scale) {
+        size_t size = cells * scale * scale * sizeof(Color);
+        for (Colors_Kernel kernel = 0; kernel < COLORS_KERNEL_COUNT; ++kernel) {
+            if (!colors_supported(kernel)) continue;
+            colors_use(kernel);
+
+            world_copy_colors_scaled(world, all, pixels, scale);
+            if (kernel == COLORS_SCALAR) memcpy(expected, pixels, size);
+            bool same = memcmp(expected, pixels, size) == 0;
+
+            size_t runs = 0;
+            uint64_t start = now_ns(), elapsed = 0;
+            while (elapsed < 200000000) {
+                world_copy_colors_scaled(world, all, pixels, scale);
+                runs += 1;
+                elapsed = now_ns() - start;
+            }
+            double secs = elapsed / 1e9;
+            printf("    colors %-6s x%zu %10.1f Mcells/s %8.2f GB/s%s\n",
+                COLORS_KERNEL_NAMES[kernel], scale,
+                runs * cells / secs / 1e6,
+                runs * (cells * 2 + size) / secs / 1e9,
+                same ? "" : "   MISMATCH");
+        }
+    }
+    colors_use(previous);
+
+    free(pixels);
+    free(expected);
+}
+
+static void run_scene(Scene *scene, Bench_Config config)
+{
+    size_t ticks;
+    World *world = scene_world(scene, config, 0, &ticks);
+    if (!world) return;
+    size_t width = world->width, height = world->height;
+
+    if (config.save_dir && !scene->path) {
+        const char *path = nob_temp_sprintf("%s/%s.fsnd", config.save_dir, scene->name);
+        if (world_save(world, path, SNAPSHOT_RAW)) nob_log(NOB_INFO, "saved %s", path);
+    }
+
+    size_t moved = 0;
+    size_t cursor = 0;
+    prof_reset();
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < ticks; ++i) {
+        world_step(world);
+        if (scene->recording) recording_play(scene->recording, &cursor, world);
+        moved += world->stats.moved;
+        prof_commit();
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    double secs = elapsed / 1e9;
+    double cells = (double)width * height * ticks;
+    printf("%-16s %10.1f %12.3f %14.2f %12zu %016" PRIx64 "\n",
+        scene->name,
+        ticks / secs,
+        elapsed / cells,
+        moved > 0 ? elapsed / (double)moved : 0.0,
+        moved,
+        world_checksum(world));
+    if (config.colors) bench_colors(world);
+
+    world_free(world);
+}
+
+typedef struct Batch_World {
+    uint64_t seed;
+    size_t cells;
+    size_t ticks;
+    size_t moved;
+    uint64_t checksum;
+    bool loaded;
+} Batch_World;
+
+typedef struct Batch {
+    Scene *scene;
+    Bench_Config config;
+    Batch_World *worlds;
+} Batch;
+
+// One world of a batch from start to finish, on whichever pool thread is
+// free. Everything it touches belongs to that world: its random streams,
+// its scratch arenas and its workers.
+static void batch_run_world(void *ctx, size_t index, size_t worker)
+{
+    (void) worker;
+    Batch *batch = ctx;
+    Batch_World *result = &batch->worlds[index];
+
+    size_t ticks;
+    World *world = scene_world(batch->scene, batch->config, index, &ticks);
+    if (!world) return;
+
+    size_t cursor = 0;
+    for (size_t i = 0; i < ticks; ++i) {
+        world_step(world);
+        if (batch->scene->recording) recording_play(batch->scene->recording, &cursor, world);
+        result->moved += world->stats.moved;
+    }
+
+    result->seed = world->seed;
+    result->cells = world->width * world->height;
+    result->ticks = ticks;
+    result->checksum = world_checksum(world);
+    result->loaded = true;
+    world_free(world);
+}
+
+// Same report as run_scene() for the whole batch, with ticks counted over
+// every world and the wall clock time of the batch, setup included. The
+// checksum column folds the checksums of all worlds, which follow one per
+// line.
+static void run_batch(Scene *scene, Bench_Config config, Pool *pool)
+{
+    Batch batch = {
+        .scene = scene,
+        .config = config,
+        .worlds = calloc(config.batch, sizeof(Batch_World)),
+    };
+    assert(batch.worlds && "Could not allocate batch");
+
+    uint64_t start = now_ns();
+    pool_run(pool, config.batch, batch_run_world, &batch);
+    uint64_t elapsed = now_ns() - start;
+
+    size_t ticks = 0, moved = 0;
+    double cells = 0;
+    uint64_t checksum = 14695981039346656037ull;
+    for (size_t i = 0; i < config.batch; ++i) {
+        Batch_World *world = &batch.worlds[i];
+        if (!world->loaded) {
+            free(batch.worlds);
+            return;
+        }
+        ticks += world->ticks;
+        moved += world->moved;
+        cells += (double)world->cells * world->ticks;
+        for (size_t k = 0; k < sizeof(world->checksum); ++k) {
+            checksum = (checksum ^ ((world->checksum >> (k * 8)) & 0xff)) * 1099511628211ull;
+        }
+    }
+
+    double secs = elapsed / 1e9;
+    printf("%-16s %10.1f %12.3f %14.2f %12zu %016" PRIx64 "\n",
+        scene->name,
+        ticks / secs,
+        elapsed / cells,
+        moved > 0 ? elapsed / (double)moved : 0.0,
+        moved,
+        checksum);
+    for (size_t i = 0; i < config.batch; ++i) {
+        printf("    seed %-20" PRIu64 " %12zu %016" PRIx64 "\n", batch.worlds[i].seed, batch.worlds[i].moved, batch.worlds[i].checksum);
+    }
+    free(batch.worlds);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-ticks N] [-size WxH] [-seed S] [-threads N] [-deterministic] [-in-place] [-sweep-all] [-batch N [-jobs J]] [-colors] [-load FILE]... [-save DIR] [-replay FILE]... [-prof-csv FILE] [scene...]\n", program);
+    fprintf(stderr, "    -threads N       update chunks in checkerboard phases on N threads, 0 sweeps serially\n");
+    fprintf(stderr, "    -deterministic   make the parallel result independent of the thread count\n");
+    fprintf(stderr, "    -in-place        move particles during the sweep instead of queueing intents\n");
+    fprintf(stderr, "    -sweep-all       visit every cell of the dirty rects instead of only the occupied ones\n");
+    fprintf(stderr, "    -batch N         run N worlds of every scene at once, seeded one apart, and print all their checksums\n");
+    fprintf(stderr, "    -jobs J          threads to run a batch on, one per core by default\n");
+    fprintf(stderr, "    -colors          time turning the final grid of every scene into pixels, with every colour kernel\n");
+    fprintf(stderr, "    -load FILE       run the world saved in a snapshot, with the seed it was saved with\n");
+    fprintf(stderr, "    -save DIR        save the starting world of every scene to DIR/<scene>.fsnd\n");
+    fprintf(stderr, "    -replay FILE     replay a session recorded with `main -record`, for as many ticks as it lasted\n");
+    fprintf(stderr, "    -prof-csv FILE   write the time spent in each phase of every tick, sample numbers restart with every scene\n");
+    fprintf(stderr, "Scenes:");
+    for (size_t i = 0; i < NOB_ARRAY_LEN(scenes); ++i) fprintf(stderr, " %s", scenes[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *program = nob_shift_args(&argc, &argv);
+
+    Bench_Config config = {
+        .width = BENCH_DEFAULT_WIDTH,
+        .height = BENCH_DEFAULT_HEIGHT,
+        .ticks = BENCH_DEFAULT_TICKS,
+        .seed = 1,
+    };
+    bool selected[NOB_ARRAY_LEN(scenes)] = {0};
+    bool any_selected = false;
+    Scenes file_scenes = {0};
+
+    while (argc > 0) {
+        const char *arg = nob_shift_args(&argc, &argv);
+        if (strcmp(arg, "-ticks") == 0 && argc > 0) {
+            config.ticks = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-size") == 0 && argc > 0) {
+            if (sscanf(nob_shift_args(&argc, &argv), "%zux%zu", &config.width, &config.height) != 2) {
+                usage(program);
+                return 1;
+            }
+        } else if (strcmp(arg, "-seed") == 0 && argc > 0) {
+            config.seed = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-threads") == 0 && argc > 0) {
+            config.threads = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-deterministic") == 0) {
+            config.deterministic = true;
+        } else if (strcmp(arg, "-in-place") == 0) {
+            config.engine = WORLD_ENGINE_IN_PLACE;
+        } else if (strcmp(arg, "-sweep-all") == 0) {
+            config.sweep_all = true;
+        } else if (strcmp(arg, "-colors") == 0) {
+            config.colors = true;
+        } else if (strcmp(arg, "-batch") == 0 && argc > 0) {
+            config.batch = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-jobs") == 0 && argc > 0) {
+            config.jobs = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-load") == 0 && argc > 0) {
+            const char *path = nob_shift_args(&argc, &argv);
+            Scene scene = { .name = path, .path = path };
+            nob_da_append(&file_scenes, scene);
+        } else if (strcmp(arg, "-prof-csv") == 0 && argc > 0) {
+            prof.enabled = true;
+            if (!prof_open_csv(nob_shift_args(&argc, &argv))) return 1;
+        } else if (strcmp(arg, "-replay") == 0 && argc > 0) {
+            const char *path = nob_shift_args(&argc, &argv);
+            Scene scene = { .name = path, .recording = malloc(sizeof(Recording)) };
+            assert(scene.recording && "Could not allocate recording");
+            if (!recording_load(scene.recording, path)) return 1;
+            nob_da_append(&file_scenes, scene);
+        } else if (strcmp(arg, "-save") == 0 && argc > 0) {
+            config.save_dir = nob_shift_args(&argc, &argv);
+            if (!nob_mkdir_if_not_exists(config.save_dir)) return 1;
+        } else {
+            bool found = false;
+            for (size_t i = 0; i < NOB_ARRAY_LEN(scenes); ++i) {
+                if (strcmp(arg, scenes[i].name) == 0) {
+                    selected[i] = true;
+                    any_selected = found = true;
+                }
+            }
+            if (!found) {
+                usage(program);
+                return 1;
+            }
+        }
+    }
+
+    // Samples are committed once per tick of a single world.
+    if (config.width < 2 || config.height < 2 || config.ticks == 0 || (config.batch > 0 && prof.enabled)) {
+        usage(program);
+        return 1;
+    }
+    if (config.jobs == 0) config.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("grid %zux%zu, %zu ticks, seed %" PRIu64 ", %s engine, %s, ", config.width, config.height, config.ticks, config.seed,
+        config.engine == WORLD_ENGINE_IN_PLACE ? "in-place" : "intents",
+        config.sweep_all ? "every cell" : "occupied cells");
+    if (config.threads > 0) {
+        printf("checkerboard on %zu threads%s", config.threads, config.deterministic ? ", deterministic" : "");
+    } else {
+        printf("serial");
+    }
+    if (config.batch > 0) {
+        printf(", batches of %zu worlds on %zu threads\n", config.batch, config.jobs);
+    } else {
+        printf("\n");
+    }
+    printf("%-16s %10s %12s %14s %12s %16s\n", "scene", "ticks/s", "ns/cell", "ns/moved", "moved", "checksum");
+
+    Pool *pool = config.batch > 0 ? pool_new(config.jobs) : NULL;
+    for (size_t i = 0; i < NOB_ARRAY_LEN(scenes); ++i) {
+        if ((any_selected || file_scenes.count > 0) && !selected[i]) continue;
+        if (pool) run_batch(&scenes[i], config, pool);
+        else run_scene(&scenes[i], config);
+    }
+    for (size_t i = 0; i < file_scenes.count; ++i) {
+        Recording *recording = file_scenes.items[i].recording;
+        if (recording && !recording_matches(recording, config.engine, config.threads, config.deterministic)) {
+            nob_log(NOB_WARNING, "%s was recorded with other engine or threading options, the replay will not match the recorded session", file_scenes.items[i].name);
+        }
+        if (pool) run_batch(&file_scenes.items[i], config, pool);
+        else run_scene(&file_scenes.items[i], config);
+        if (recording) {
+            recording_free(recording);
+            free(recording);
+        }
+    }
+    nob_da_free(file_scenes);
+    if (pool) pool_free(pool);
+    prof_close_csv();
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "brush.h"
+#include "prof.h"
+
+// Half widths of the rows of a circle of every radius: row dy of radius r
+// spans [-half, half] with half = brush_masks[r][dy + r]. Filled once on
+// first use, read only afterwards.
+static int16_t *brush_masks[BRUSH_MAX_RADIUS + 1];
+static pthread_once_t brush_masks_once = PTHREAD_ONCE_INIT;
+
+static void brush_masks_init(void)
+{
+    for (int r = 0; r <= BRUSH_MAX_RADIUS; ++r) {
+        brush_masks[r] = malloc(sizeof(int16_t) * (2 * r + 1));
+        assert(brush_masks[r] && "Could not allocate brush masks");
+        for (int dy = -r; dy <= r; ++dy) {
+            brush_masks[r][dy + r] = (int16_t)sqrtf((float)(r * r - dy * dy));
+        }
+    }
+}
+
+float brush_clamp_radius(float radius)
+{
+    return CLAMP(radius, BRUSH_MIN_RADIUS, BRUSH_MAX_RADIUS);
+}
+
+void brush_stroke(World *world, float x0, float y0, float x1, float y1, float radius, Particle_Type type)
+{
+    uint64_t start = prof_begin();
+    pthread_once(&brush_masks_once, brush_masks_init);
+
+    int r = brush_clamp_radius(radius);
+    const int16_t *mask = brush_masks[r];
+    int ax = floorf(x0), ay = floorf(y0);
+    int bx = floorf(x1), by = floorf(y1);
+
+    // Rows the stroke can touch, clipped to the world.
+    int top = (ay < by ? ay : by) - r;
+    int bottom = (ay > by ? ay : by) + r + 1;
+    if (top < 0) top = 0;
+    if (bottom > (int)world->height) bottom = world->height;
+    if (top >= bottom) {
+        prof_end(PROF_BRUSH, start);
+        return;
+    }
+
+    // The stroke is convex, so every row it touches is a single span: the
+    // union of the spans of circles centred on every cell along the segment.
+    size_t rows = bottom - top;
+    Arena_Mark mark = arena_snapshot(&world->scratch);
+    int *left = arena_alloc(&world->scratch, sizeof(int) * rows * 2);
+    int *right = left + rows;
+    for (size_t i = 0; i < rows; ++i) {
+        left[i] = INT_MAX;
+        right[i] = INT_MIN;
+    }
+
+    int dx = abs(bx - ax), dy = abs(by - ay);
+    int steps = dx > dy ? dx : dy;
+    for (int s = 0; s <= steps; ++s) {
+        int cx = steps == 0 ? ax : ax + (bx - ax) * s / steps;
+        int cy = steps == 0 ? ay : ay + (by - ay) * s / steps;
+        int from = cy - r < top ? top : cy - r;
+        int to = cy + r + 1 > bottom ? bottom : cy + r + 1;
+        for (int y = from; y < to; ++y) {
+            int half = mask[y - cy + r];
+            if (cx - half < left[y - top]) left[y - top] = cx - half;
+            if (cx + half > right[y - top]) right[y - top] = cx + half;
+        }
+    }
+
+    uint32_t threshold = (128 + particle_chance(type) / 2) / particle_chance(type);
+    if (threshold < 1) threshold = 1;
+
+    int min_x = INT_MAX, max_x = INT_MIN;
+    for (size_t i = 0; i < rows; ++i) {
+        int span_x0 = left[i] < 0 ? 0 : left[i];
+        int span_x1 = right[i] + 1 > (int)world->width ? (int)world->width : right[i] + 1;
+        if (span_x0 >= span_x1) continue;
+        if (type == PT_EMPTY) world_erase_span(world, top + i, span_x0, span_x1);
+        else world_paint_span(world, top + i, span_x0, span_x1, type, threshold);
+        if (span_x0 < min_x) min_x = span_x0;
+        if (span_x1 > max_x) max_x = span_x1;
+    }
+    if (min_x < max_x) world_wake_rect(world, min_x, top, max_x, bottom);
+
+    arena_rewind(&world->scratch, mark);
+    prof_end(PROF_BRUSH, start);
+}
@@ -0,0 +1,22 @@
+#ifndef BRUSH_H_
+#define BRUSH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "world.h"
+
+// Brush radii are whole cells in [BRUSH_MIN_RADIUS, BRUSH_MAX_RADIUS].
+#define BRUSH_MIN_RADIUS 1
+#define BRUSH_MAX_RADIUS 128
+
+float brush_clamp_radius(float radius);
+
+// Paint (or erase, for PT_EMPTY) every cell within `radius` of the segment
+// from (x0, y0) to (x1, y1). A stroke covers each cell once, however far the
+// brush moved, so a fast mouse leaves a solid line instead of dots and does
+// not paint denser where stamps would overlap. A stamp is a stroke of length
+// zero.
+void brush_stroke(World *world, float x0, float y0, float x1, float y1, float radius, Particle_Type type);
+
+#endif // BRUSH_H_
@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLORS_X86 1
+#endif
+
+#include "colors.h"
+
+static_assert(sizeof(Color) == sizeof(uint32_t), "colours are gathered as 32 bit words");
+static_assert(PT_COUNT << PALETTE_SHADE_BITS <= 256, "palette indices must fit a byte");
+
+const char *COLORS_KERNEL_NAMES[COLORS_KERNEL_COUNT] = {
+    [COLORS_SCALAR] = "scalar",
+    [COLORS_SSSE3]  = "ssse3",
+    [COLORS_AVX2]   = "avx2",
+};
+
+typedef void (*Colors_Fn)(const uint8_t *types, const uint8_t *shades, uint32_t *pixels, size_t count);
+
+static inline uint32_t colors_lookup(const uint32_t *palette, uint8_t type, uint8_t shade)
+{
+    return palette[(type << PALETTE_SHADE_BITS) | shade];
+}
+
+static void colors_scalar(const uint8_t *types, const uint8_t *shades, uint32_t *pixels, size_t count)
+{
+    const uint32_t *palette = (const uint32_t *)PARTICLE_PALETTE;
+    for (size_t i = 0; i < count; ++i) {
+        pixels[i] = colors_lookup(palette, types[i], shades[i]);
+    }
+}
+
+#ifdef COLORS_X86
+static_assert(PALETTE_SHADES == 16, "shades index pshufb tables of sixteen bytes");
+
+// Sixteen cells per iteration, with pshufb as a lookup in sixteen entry
+// tables: byte b of the colours of a type, indexed by shade, one table per
+// type and byte. Each type present in the cells takes a lookup per byte, the
+// shades of cells of other types get bit 7 set so pshufb gives 0 for them.
+__attribute__((target("ssse3")))
+static void colors_ssse3(const uint8_t *types, const uint8_t *shades, uint32_t *pixels, size_t count)
+{
+    size_t i = 0;
+    if (count >= 16) {
+        // Transpose the palette of every type into its four byte planes.
+        __m128i planes[PT_COUNT][4];
+        const __m128i bytes = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+        for (size_t type = 0; type < PT_COUNT; ++type) {
+            const __m128i *palette = (const __m128i *)PARTICLE_PALETTE[type];
+            __m128i c0 = _mm_shuffle_epi8(_mm_loadu_si128(&palette[0]), bytes);
+            __m128i c1 = _mm_shuffle_epi8(_mm_loadu_si128(&palette[1]), bytes);
+            __m128i c2 = _mm_shuffle_epi8(_mm_loadu_si128(&palette[2]), bytes);
+            __m128i c3 = _mm_shuffle_epi8(_mm_loadu_si128(&palette[3]), bytes);
+            __m128i low01 = _mm_unpacklo_epi32(c0, c1), high01 = _mm_unpackhi_epi32(c0, c1);
+            __m128i low23 = _mm_unpacklo_epi32(c2, c3), high23 = _mm_unpackhi_epi32(c2, c3);
+            planes[type][0] = _mm_unpacklo_epi64(low01, low23);
+            planes[type][1] = _mm_unpackhi_epi64(low01, low23);
+            planes[type][2] = _mm_unpacklo_epi64(high01, high23);
+            planes[type][3] = _mm_unpackhi_epi64(high01, high23);
+        }
+
+        const __m128i miss = _mm_set1_epi8((char)0x80);
+        for (; i + 16 <= count; i += 16) {
+            __m128i t = _mm_loadu_si128((const __m128i *)&types[i]);
+            __m128i s = _mm_loadu_si128((const __m128i *)&shades[i]);
+            __m128i out[4] = {0};
+            for (size_t type = 0; type < PT_COUNT; ++type) {
+                __m128i match = _mm_cmpeq_epi8(t, _mm_set1_epi8((char)type));
+                if (_mm_movemask_epi8(match) == 0) continue;
+                __m128i index = _mm_or_si128(s, _mm_andnot_si128(match, miss));
+                for (size_t b = 0; b < 4; ++b) {
+                    out[b] = _mm_or_si128(out[b], _mm_shuffle_epi8(planes[type][b], index));
+                }
+            }
+
+            // Interleave the byte planes back into colours.
+            __m128i low01 = _mm_unpacklo_epi8(out[0], out[1]), high01 = _mm_unpackhi_epi8(out[0], out[1]);
+            __m128i low23 = _mm_unpacklo_epi8(out[2], out[3]), high23 = _mm_unpackhi_epi8(out[2], out[3]);
+            _mm_storeu_si128((__m128i *)&pixels[i], _mm_unpacklo_epi16(low01, low23));
+            _mm_storeu_si128((__m128i *)&pixels[i + 4], _mm_unpackhi_epi16(low01, low23));
+            _mm_storeu_si128((__m128i *)&pixels[i + 8], _mm_unpacklo_epi16(high01, high23));
+            _mm_storeu_si128((__m128i *)&pixels[i + 12], _mm_unpackhi_epi16(high01, high23));
+        }
+    }
+    colors_scalar(types + i, shades + i, pixels + i, count - i);
+}
+
+// 32 cells per iteration in four gathers of eight.
+__attribute__((target("avx2")))
+static void colors_avx2(const uint8_t *types, const uint8_t *shades, uint32_t *pixels, size_t count)
+{
+    const int *palette = (const int *)PARTICLE_PALETTE;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        for (size_t k = 0; k < 32; k += 8) {
+            __m256i t = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&types[i + k]));
+            __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&shades[i + k]));
+            __m256i index = _mm256_or_si256(_mm256_slli_epi32(t, PALETTE_SHADE_BITS), s);
+            _mm256_storeu_si256((__m256i *)&pixels[i + k], _mm256_i32gather_epi32(palette, index, sizeof(uint32_t)));
+        }
+    }
+    colors_scalar(types + i, shades + i, pixels + i, count - i);
+}
+
+// Same, writing every colour twice in place, which saves spreading the row
+// out in a second pass.
+__attribute__((target("avx2")))
+static void colors_avx2_x2(const uint8_t *types, const uint8_t *shades, uint32_t *pixels, size_t count)
+{
+    const int *palette = (const int *)PARTICLE_PALETTE;
+    const __m256i low = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i high = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i t = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&types[i]));
+        __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&shades[i]));
+        __m256i index = _mm256_or_si256(_mm256_slli_epi32(t, PALETTE_SHADE_BITS), s);
+        __m256i colors = _mm256_i32gather_epi32(palette, index, sizeof(uint32_t));
+        _mm256_storeu_si256((__m256i *)&pixels[i * 2], _mm256_permutevar8x32_epi32(colors, low));
+        _mm256_storeu_si256((__m256i *)&pixels[i * 2 + 8], _mm256_permutevar8x32_epi32(colors, high));
+    }
+    const uint32_t *flat = (const uint32_t *)PARTICLE_PALETTE;
+    for (; i < count; ++i) {
+        pixels[i * 2] = pixels[i * 2 + 1] = colors_lookup(flat, types[i], shades[i]);
+    }
+}
+#endif // COLORS_X86
+
+static const Colors_Fn colors_fns[COLORS_KERNEL_COUNT] = {
+    [COLORS_SCALAR] = colors_scalar,
+#ifdef COLORS_X86
+    [COLORS_SSSE3] = colors_ssse3,
+    [COLORS_AVX2] = colors_avx2,
+#endif // COLORS_X86
+};
+
+// Kernels that write every colour twice themselves, the others have their
+// rows spread out afterwards.
+static const Colors_Fn colors_fns_x2[COLORS_KERNEL_COUNT] = {
+#ifdef COLORS_X86
+    [COLORS_AVX2] = colors_avx2_x2,
+#endif // COLORS_X86
+};
+
+static Colors_Kernel colors_current;
+static pthread_once_t colors_once = PTHREAD_ONCE_INIT;
+
+static void colors_pick(void)
+{
+    for (int kernel = COLORS_KERNEL_COUNT - 1; kernel >= 0; --kernel) {
+        if (colors_supported(kernel)) {
+            colors_current = kernel;
+            return;
+        }
+    }
+}
+
+bool colors_supported(Colors_Kernel kernel)
+{
+    if ((int)kernel < 0 || kernel >= COLORS_KERNEL_COUNT || !colors_fns[kernel]) return false;
+#ifdef COLORS_X86
+    __builtin_cpu_init();
+    if (kernel == COLORS_SSSE3) return __builtin_cpu_supports("ssse3");
+    if (kernel == COLORS_AVX2) return __builtin_cpu_supports("avx2");
+#endif // COLORS_X86
+    return true;
+}
+
+void colors_use(Colors_Kernel kernel)
+{
+    pthread_once(&colors_once, colors_pick);
+    if (colors_supported(kernel)) colors_current = kernel;
+}
+
+Colors_Kernel colors_kernel(void)
+{
+    pthread_once(&colors_once, colors_pick);
+    return colors_current;
+}
+
+void colors_convert(const uint8_t *types, const uint8_t *shades, Color *pixels, size_t count)
+{
+    colors_fns[colors_kernel()](types, shades, (uint32_t *)pixels, count);
+}
+
+void colors_convert_scaled(const uint8_t *types, const uint8_t *shades, Color *pixels, size_t count, size_t scale)
+{
+    Colors_Kernel kernel = colors_kernel();
+    if (scale == 2 && colors_fns_x2[kernel]) {
+        colors_fns_x2[kernel](types, shades, (uint32_t *)pixels, count);
+        return;
+    }
+
+    colors_fns[kernel](types, shades, (uint32_t *)pixels, count);
+    if (scale <= 1) return;
+
+    // Spread the row out from the back, every colour moves right of where it
+    // was read from, so nothing is overwritten before it is read.
+    uint32_t *row = (uint32_t *)pixels;
+    if (scale == 2) {
+        for (size_t i = count; i-- > 0;) {
+            uint64_t pair = row[i] * 0x100000001ull;
+            memcpy(&row[i * 2], &pair, sizeof(pair));
+        }
+        return;
+    }
+    for (size_t i = count; i-- > 0;) {
+        uint32_t color = row[i];
+        for (size_t k = scale; k-- > 0;) row[i * scale + k] = color;
+    }
+}
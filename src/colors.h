@@ -0,0 +1,37 @@
+#ifndef COLORS_H_
+#define COLORS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "world.h"
+
+// Turning the type and shade planes into pixels. The colour of a cell is
+// entry (type << PALETTE_SHADE_BITS) | shade of the flattened palette, so a
+// conversion is one table lookup per cell and runs at memory speed with the
+// right kernel: AVX2 gathers eight cells per instruction, SSSE3 looks sixteen
+// up at a time with pshufb in per type tables, and the scalar kernel works
+// everywhere. The fastest one the CPU supports is picked on first use.
+typedef enum Colors_Kernel {
+    COLORS_SCALAR = 0,
+    COLORS_SSSE3,
+    COLORS_AVX2,
+    COLORS_KERNEL_COUNT
+} Colors_Kernel;
+
+extern const char *COLORS_KERNEL_NAMES[COLORS_KERNEL_COUNT];
+
+bool colors_supported(Colors_Kernel kernel);
+// The kernel every conversion uses from now on, ignored if the CPU does not
+// support it.
+void colors_use(Colors_Kernel kernel);
+Colors_Kernel colors_kernel(void);
+
+// pixels[i] = PARTICLE_PALETTE[types[i]][shades[i]] for every i < count.
+void colors_convert(const uint8_t *types, const uint8_t *shades, Color *pixels, size_t count);
+// Same, with every cell repeated `scale` times in a row. `pixels` needs room
+// for count * scale colours.
+void colors_convert_scaled(const uint8_t *types, const uint8_t *shades, Color *pixels, size_t count, size_t scale);
+
+#endif // COLORS_H_
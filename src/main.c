@@ -1,16 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 
 #include <raylib.h>
 #include <raymath.h>
 
+#define NOB_IMPLEMENTATION
 #include "nob.h"
 
-#define ARENA_IMPLEMENTATION
-#include "arena.h"
+#include "world.h"
+#include "snapshot.h"
+#include "recording.h"
+#include "prof.h"
+#include "sim.h"
+#include "brush.h"
+#include "stream.h"
 
 #define SCREEN_WIDTH  1280
 #define SCREEN_HEIGHT 720
@@ -25,349 +33,179 @@
 #define GRID_HEIGHT     (SCREEN_HEIGHT/CELL_SIZE_PX)
 #define GRID_INDEX(g, x, y) ((g)[GRID_WIDTH * x + y])
 
-#define RAND_FLOAT ((float)(rand()) / (float)(RAND_MAX))
+#define SNAPSHOT_PATH "world.fsnd"
 
-#define CLAMP(value, low, high) (((value) < (low)) ? (low) : (((value) > (high)) ? (high) : (value)))
+// Cells around the view that keep being simulated, so what falls or flows
+// in from just off screen keeps doing so.
+#define REGION_MARGIN (2 * CHUNK_SIZE)
+// Cells per second the arrow keys move the view by.
+#define CAMERA_SPEED 400
 
+#define STREAM_DEFAULT_BUDGET_MB 256
 
-typedef enum Particle_Properties : uint32_t {
-    PP_NONE           = 1 << 0,
-
-    PP_SOLID          = 1 << 1,
-    PP_LIQUID         = 1 << 2,
-    PP_GAS            = 1 << 3,
-
-    PP_MOVE_DOWN      = 1 << 4,
-    PP_MOVE_DOWN_SIDE = 1 << 5,
-    PP_MOVE_SIDE      = 1 << 6,
-} Particle_Properties;
-
-typedef enum Particle_Type : uint32_t {
-    PT_EMPTY = 0,
-    PT_SAND,
-    PT_WATER,
-    PT_STONE,
-    PT_COUNT
-} Particle_Type;
-
-static const char *PARTICLE_TYPE_NAMES[] = {"Empty", "Sand", "Water", "Stone", "Count"};
-
-typedef struct Vector2i {
-    int x;
-    int y;
-} Vector2i;
-
-typedef struct Particle {
-    Particle_Type type;
-    Particle_Properties props;
-    Color color;
-
-    bool free_falling;
-    Vector2 velocity;
-    int spread_factor;
-} Particle;
-
-void particle_set(Particle *p, Particle_Type type)
-{
-    p->type = type;
-    p->props = PP_NONE;
-    p->color = BLANK;
-
-    switch (type) {
-        case PT_SAND: {
-            p->props = PP_SOLID | PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE;
-            p->color = ColorBrightness(CLITERAL(Color){.r=235,.g=200,.b=175,.a=255},((RAND_FLOAT*2)-1)/4);
-            break;
-        }
-        case PT_WATER: {
-            p->props = PP_LIQUID | PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE | PP_MOVE_SIDE;
-            p->color = ColorBrightness(CLITERAL(Color){.r=175,.g=200,.b=235,.a=255},((RAND_FLOAT*2)-1)/4);
-            p->spread_factor = 5;
-            break;
-        }
-        case PT_STONE: {
-            p->props = PP_SOLID;
-            p->color = ColorBrightness(GRAY,((RAND_FLOAT*2)-1)/4);
-            break;
-        }
-        default: break;
-    }
-}
-
-int particle_chance(Particle_Type type) {
-    switch(type) {
-        case PT_SAND:
-        case PT_WATER: return 10;
-        default: return 1;
-    }
-}
-
-typedef struct Particle_Updates {
-    Vector2i *items;
-    size_t count;
-    size_t capacity;
-} Particle_Updates;
-
-typedef struct World {
-    size_t width;
-    size_t height;
-    double scale;
-    Particle *particles;
-    Particle_Updates particle_updates;
-
+typedef struct Canvas {
     Color *image_data;
+    World_Rect *rects;
     Image image;
     Texture2D texture;
-} World;
-
-World *world_new(size_t width, size_t height, double scale)
-{
-    World *world = malloc(sizeof(World));
-    assert(world && "Could not allocate world");
-    memset(world, 0, sizeof(*world));
-
-    world->width = width / scale;
-    world->height = height / scale;
-    world->scale = scale;
-
-    Particle *particles = malloc(sizeof(Particle) * width * height);
-    assert(particles && "Could not allocate particles");
-    memset(particles, 0, sizeof(*particles));
-
-    for (size_t y = 0; y < height; ++y) {
-        for (size_t x = 0; x < width; ++x) {
-            Particle particle = {0};
-            particle.color = BLANK;
-            particles[x + y * width] = particle;
-        }
-    }
-
-    world->particles = particles;
-
-    world->image_data = malloc(sizeof(Color) * world->width * world->height);
-    for (size_t i = 0; i < world->width * world->height; ++i) {
-        world->image_data[i] = world->particles[i].color;
-    }
-
-    world->image = GenImageColor(world->width, world->height, BLANK);
-    world->texture = LoadTextureFromImage(world->image);
-
-    return world;
-}
-
-void world_free(World *world)
+    // The cells the texture shows, once it has been filled.
+    World_Rect view;
+    bool filled;
+} Canvas;
+
+// A texture of as much of the world as fits on screen, the view the camera
+// moves around the world.
+Canvas canvas_new(World *world, size_t view_width, size_t view_height)
 {
-    free(world->image_data);
-    UnloadImage(world->image);
-    UnloadTexture(world->texture);
-    nob_da_free(world->particle_updates);
-    free(world);
+    size_t width = world->width < view_width ? world->width : view_width;
+    size_t height = world->height < view_height ? world->height : view_height;
+    // Room for the changed rects of every chunk the region around the view
+    // can overlap.
+    size_t region_chunks_width = (width + 2 * REGION_MARGIN) / CHUNK_SIZE + 2;
+    size_t region_chunks_height = (height + 2 * REGION_MARGIN) / CHUNK_SIZE + 2;
+
+    Canvas canvas = {0};
+    canvas.image_data = malloc(sizeof(Color) * width * height);
+    assert(canvas.image_data && "Could not allocate image data");
+    canvas.rects = malloc(sizeof(World_Rect) * region_chunks_width * region_chunks_height);
+    assert(canvas.rects && "Could not allocate canvas rects");
+    canvas.image = GenImageColor(width, height, BLANK);
+    canvas.texture = LoadTextureFromImage(canvas.image);
+    canvas.view = (World_Rect) { .width = width, .height = height };
+    return canvas;
 }
 
-Color *world_update_image_data(World *world)
+void canvas_free(Canvas *canvas)
 {
-    for (size_t i = 0; i < world->width * world->height; ++i) {
-        world->image_data[i] = world->particles[i].color;
-    }
-    return world->image_data;
-}
-
-Vector2i world_get_pos(World *world, size_t index) {
-    return (Vector2i) {
-        .x = index % world->width,
-        .y = index / world->width,
-    };
-}
-
-
-size_t world_get_index(World *world, size_t x, size_t y) {
-    return x + y * world->width;
-}
-
-Particle world_get_at_index(World *world, size_t i) {
-    return world->particles[i];
-}
-
-Particle world_get_at(World *world, size_t x, size_t y) {
-    return world_get_at_index(world, world_get_index(world, x, y));
-}
-
-bool world_in_bounds(World *world, size_t x, size_t y) {
-    return x < world->width && y < world->height;
-}
-
-bool world_is_empty(World *world, size_t x, size_t y) {
-    return world_in_bounds(world, x, y) && world_get_at(world, x, y).type == PT_EMPTY;
+    free(canvas->image_data);
+    free(canvas->rects);
+    UnloadImage(canvas->image);
+    UnloadTexture(canvas->texture);
 }
 
-
-void world_set_particle(World *world, size_t x, size_t y, Particle p)
+// The part of the world that ticks, the view with REGION_MARGIN cells around
+// it. world_take_changed_rects() never returns more rects than fit in
+// `canvas->rects` while it is set.
+World_Rect canvas_region(const Canvas *canvas, Vector2 camera)
 {
-    world->particles[world_get_index(world, x, y)] = p;
-}
-
-
-void world_move_particle(World *world, size_t x_src, size_t y_src, size_t x_dst, size_t y_dst)
-{
-    Vector2i update = {
-        .x = world_get_index(world, x_dst, y_dst),
-        .y = world_get_index(world, x_src, y_src)
+    return (World_Rect) {
+        .x = (int)camera.x - REGION_MARGIN,
+        .y = (int)camera.y - REGION_MARGIN,
+        .width = canvas->view.width + 2 * REGION_MARGIN,
+        .height = canvas->view.height + 2 * REGION_MARGIN,
     };
-    nob_da_append(&world->particle_updates, update);
 }
 
-void world_update_particles(World *world)
+// Upload only the parts of the view that changed since the last call, on a
+// settled frame this does nothing at all. All of it when the view moved.
+void canvas_update(Canvas *canvas, World *world, int view_x, int view_y)
 {
-    if (world->particle_updates.count < 1) return;
-
-    // remove moves that have their dst filled
-    for (size_t i = 0; i < world->particle_updates.count; ++i) {
-        Vector2i *it = &world->particle_updates.items[i]; // { .x = dst, .y = src }
-        if (world->particles[it->x].type != PT_EMPTY) {
-            it->x = -1;
-            it->y = -1;
-        }
+    size_t count = world_take_changed_rects(world, canvas->rects);
+    if (!canvas->filled || view_x != canvas->view.x || view_y != canvas->view.y) {
+        canvas->view.x = view_x;
+        canvas->view.y = view_y;
+        canvas->filled = true;
+        canvas->rects[0] = canvas->view;
+        count = 1;
     }
 
-    // shuffle the array using the Fisher-Yates algorithm
-    nob_da_append(&world->particle_updates, (Vector2i){ 0 });
-    for (size_t i = 0; i < world->particle_updates.count - 1; ++i) {
-        size_t j = i + rand() / (RAND_MAX / (world->particle_updates.count - i) + 1);
-        Vector2i temp = world->particle_updates.items[j];
-        world->particle_updates.items[j] = world->particle_updates.items[i];
-        world->particle_updates.items[i] = temp;
+    World_Rect view = canvas->view;
+    for (size_t i = 0; i < count; ++i) {
+        World_Rect rect = canvas->rects[i];
+        int x0 = CLAMP(rect.x, view.x, view.x + view.width);
+        int y0 = CLAMP(rect.y, view.y, view.y + view.height);
+        int x1 = CLAMP(rect.x + rect.width, x0, view.x + view.width);
+        int y1 = CLAMP(rect.y + rect.height, y0, view.y + view.height);
+        if (x0 == x1 || y0 == y1) continue;
+        rect = (World_Rect) { .x = x0, .y = y0, .width = x1 - x0, .height = y1 - y0 };
+
+        PROF_SCOPE(PROF_COPY_COLORS) world_copy_colors(world, rect, canvas->image_data);
+        PROF_SCOPE(PROF_UPLOAD) UpdateTextureRec(
+        canvas->texture,
+        (Rectangle){
+            .x = rect.x - view.x,
+            .y = rect.y - view.y,
+            .width = rect.width,
+            .height = rect.height,
+        },
+        canvas->image_data
+        );
     }
+}
 
-    for (size_t i = 0; i < world->particle_updates.count; ++i) {
-        Vector2i it = world->particle_updates.items[i];
-
-        // swap the cells if both src and dst exist.
-        if (it.x >= 0 && it.y >= 0) {
-            Particle p_dst = world_get_at_index(world, it.x);
-            Particle p_src = world_get_at_index(world, it.y);
-
-            // Bresenham's line algorith:
-            // traverse line from p_src -> p_dst
-
-            Vector2i dst = world_get_pos(world, it.x);
-            Vector2i src = world_get_pos(world, it.y);
-
-            int x0 = src.x;
-            int y0 = src.y;
-            int x1 = dst.x;
-            int y1 = dst.y;
-            int dx = abs(x1 - x0);
-            int dy = abs(y1 - y0);
-            int sx = x0 < x1 ? 1 : -1;
-            int sy = y0 < y1 ? 1 : -1;
-            int err = dx - dy;
-
-            while (x0 != x1 || y0 != y1) {
-                int e2 = 2 * err;
-                if (e2 > -dy) {
-                    err -= dy;
-                    x0 += sx;
-                }
-                if (e2 < dx) {
-                    err += dx;
-                    y0 += sy;
-                }
-
-                // process cell at (x0, y0)
-                Particle p_t = world_get_at(world, x0, y0);
-                if (p_t.type == PT_EMPTY || (p_src.props & PP_SOLID && p_t.props & PP_LIQUID)) {
-                    world->particles[world_get_index(world, x1, y1)] = p_src;
-                    world->particles[it.y] = p_t;
-                    p_t = p_src;
-                }
-            }
-
-            Particle p_t = world_get_at(world, x1, y1);
-            if (p_t.type == PT_EMPTY  || (p_src.props & PP_SOLID && p_t.props & PP_LIQUID)) {
-                world->particles[world_get_index(world, x1, y1)] = p_src;
-                world->particles[it.y] = p_t;
-                p_t = p_src;
-            }
-
-            // world->particles[it.x] = p_src;
-            // world->particles[it.y] = p_dst;
+// Same for a frame published by the sim thread, which says itself what
+// changed since the frame uploaded before it.
+void canvas_upload_frame(Canvas *canvas, World *world, const Sim_Frame *frame)
+{
+    World_Rect rect = frame->upload;
+    if (rect.width == 0) return;
+    PROF_SCOPE(PROF_COPY_COLORS) {
+        for (int y = 0; y < rect.height; ++y) {
+            memcpy(&canvas->image_data[y * rect.width], &frame->pixels[world_get_index(world, rect.x, rect.y + y)], sizeof(Color) * rect.width);
         }
     }
-
-    world->particle_updates.count = 0;
+    PROF_SCOPE(PROF_UPLOAD) UpdateTextureRec(
+    canvas->texture,
+    (Rectangle){
+        .x = rect.x,
+        .y = rect.y,
+        .width = rect.width,
+        .height = rect.height,
+    },
+    canvas->image_data
+    );
 }
 
-bool world_move_down(World *world, size_t x, size_t y)
+// Apply the command line settings to a world, new or loaded.
+void world_configure(World *world, World_Engine engine, size_t threads, bool deterministic)
 {
-    Particle p = world_get_at(world, x, y);
-    if (p.free_falling) {
-        float g_accel = 1;
-        p.velocity.y += g_accel;
-        p.color = RED;
-    } else {
-        p.velocity.y = 0;
-    }
-    world_set_particle(world,x,y,p);
-    if (!world_in_bounds(world, x, y + 1 + p.velocity.y)) return false;
-    Particle p_down = world_get_at(world, x, y + 1 + p.velocity.y);
-
-    if (p_down.type == PT_EMPTY)
-    {
-        world_move_particle(world, x, y, x, y + 1 + p.velocity.y);
-        return true;
-    } else if (p.props & PP_SOLID && p_down.props & PP_LIQUID)
-    {
-        world_move_particle(world, x, y, x, y + 1 + p.velocity.y);
-        world_move_particle(world, x, y + 1 + p.velocity.y, x, y);
-        return true;
+    world->engine = engine;
+    if (threads > 0) {
+        world->parallel = true;
+        world->deterministic = deterministic;
+        world_set_threads(world, threads);
     }
-    return false;
-
-
-    // bool down = p_down->type != PT_EMPTY;
-
-    // if (down)
-    // // world_move_particle(world, x, y, x, y + 1 + p.velocity.y);
-    // world_move_particle(world, x, y, x, y + 1);
-    // else
-    // p.free_falling = false;
-    // return down;
 }
 
-bool world_move_down_side(World *world, size_t x, size_t y)
+// Simulation ticks per second over the last `samples` frames.
+float prof_tick_rate(size_t samples)
 {
-    bool down_left = world_is_empty(world, x - 1, y + 1);
-    bool down_right = world_is_empty(world, x + 1, y + 1);
-
-    if (down_left && down_right) {
-        down_left = GetRandomValue(0,1) == 0;
-        down_right = !down_left;
+    uint64_t ns = 0, ticks = 0;
+    for (size_t i = 0; i < samples && prof_sample(i); ++i) {
+        ns += prof_sample(i)->ns[PROF_FRAME];
+        ticks += prof_sample(i)->ticks;
     }
-
-    if (down_left)
-    world_move_particle(world, x, y, x - 1, y + 1);
-    else if (down_right)
-    world_move_particle(world, x, y, x + 1, y + 1);
-
-    return down_left || down_right;
+    return ns > 0 ? ticks * 1e9f / ns : 0.0f;
 }
 
-bool world_move_side(World *world, size_t x, size_t y)
+// Per phase p50/p99 over the recent frames and a graph of the frame times,
+// with a line at `budget` seconds.
+void prof_draw_overlay(int x, int y, float budget)
 {
-    bool left = world_is_empty(world, x - 1, y);
-    bool right = world_is_empty(world, x + 1, y);
-
-    if (left && right) {
-        left = GetRandomValue(0, 1) == 0;
-        right = !left;
+    const int font = 20;
+    const int width = 420;
+    const int graph_height = 100;
+    int height = (PROF_COUNT + 1) * font + graph_height + 30;
+    DrawRectangle(x, y, width, height, (Color){ .r = 0, .g = 0, .b = 0, .a = 180 });
+
+    DrawText("phase           p50 ms    p99 ms", x + 10, y + 5, font, WHITE);
+    for (size_t i = 0; i < PROF_COUNT; ++i) {
+        int row = y + 5 + (i + 1) * font;
+        DrawText(PROF_PHASE_NAMES[i], x + 10, row, font, WHITE);
+        DrawText(TextFormat("%7.3f", prof_percentile(i, 0.50) / 1e6), x + 170, row, font, WHITE);
+        DrawText(TextFormat("%7.3f", prof_percentile(i, 0.99) / 1e6), x + 270, row, font, WHITE);
     }
 
-    if (left)
-    world_move_particle(world, x, y, x - 1, y);
-    else if (right)
-    world_move_particle(world, x, y, x + 1, y);
-
-    return left || right;
+    // Twice the budget fills the graph, frames over budget are drawn in red.
+    int graph_y = y + height - graph_height - 10;
+    float scale = graph_height / (2.0f * budget * 1e9f);
+    for (size_t i = 0; i < (size_t)(width - 20) && prof_sample(i); ++i) {
+        uint64_t ns = prof_sample(i)->ns[PROF_FRAME];
+        int bar = ns * scale;
+        if (bar > graph_height) bar = graph_height;
+        DrawLine(x + width - 10 - i, graph_y + graph_height, x + width - 10 - i, graph_y + graph_height - bar, ns > budget * 1e9f ? RED : GREEN);
+    }
+    DrawLine(x + 10, graph_y + graph_height / 2, x + width - 10, graph_y + graph_height / 2, YELLOW);
 }
 
 /*void particle_set(Particle **board, size_t x, size_t y, Material_Id mat)
@@ -378,15 +216,94 @@ bool world_move_side(World *world, size_t x, size_t y)
 }*/
 
 #define FIXED_UPDATE
-int main(void)
+int main(int argc, char **argv)
 {
+    const char *program = nob_shift_args(&argc, &argv);
+    size_t threads = 0;
+    bool deterministic = false;
+    World_Engine engine = WORLD_ENGINE_INTENTS;
+    uint64_t seed = time(NULL);
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *prof_csv_path = NULL;
+    bool sim_thread = false;
+    size_t max_catch_up = SCHED_DEFAULT_CATCH_UP;
+    Sched_Policy overload = SCHED_DROP;
+    size_t world_width = SCREEN_WIDTH / SCREEN_SCALE;
+    size_t world_height = SCREEN_HEIGHT / SCREEN_SCALE;
+    const char *stream_path = NULL;
+    size_t budget_mb = STREAM_DEFAULT_BUDGET_MB;
+    bool usage = false;
+    while (argc > 0) {
+        const char *arg = nob_shift_args(&argc, &argv);
+        if (strcmp(arg, "-threads") == 0 && argc > 0) {
+            threads = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-deterministic") == 0) {
+            deterministic = true;
+        } else if (strcmp(arg, "-in-place") == 0) {
+            engine = WORLD_ENGINE_IN_PLACE;
+        } else if (strcmp(arg, "-seed") == 0 && argc > 0) {
+            seed = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-record") == 0 && argc > 0) {
+            record_path = nob_shift_args(&argc, &argv);
+        } else if (strcmp(arg, "-replay") == 0 && argc > 0) {
+            replay_path = nob_shift_args(&argc, &argv);
+        } else if (strcmp(arg, "-prof-csv") == 0 && argc > 0) {
+            prof_csv_path = nob_shift_args(&argc, &argv);
+        } else if (strcmp(arg, "-sim-thread") == 0) {
+            sim_thread = true;
+        } else if (strcmp(arg, "-catch-up") == 0 && argc > 0) {
+            max_catch_up = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else if (strcmp(arg, "-overload") == 0 && argc > 0 && strcmp(argv[0], "drop") == 0) {
+            nob_shift_args(&argc, &argv);
+            overload = SCHED_DROP;
+        } else if (strcmp(arg, "-overload") == 0 && argc > 0 && strcmp(argv[0], "degrade") == 0) {
+            nob_shift_args(&argc, &argv);
+            overload = SCHED_DEGRADE;
+        } else if (strcmp(arg, "-world") == 0 && argc > 0) {
+            usage |= sscanf(nob_shift_args(&argc, &argv), "%zux%zu", &world_width, &world_height) != 2;
+        } else if (strcmp(arg, "-stream") == 0 && argc > 0) {
+            stream_path = nob_shift_args(&argc, &argv);
+        } else if (strcmp(arg, "-budget") == 0 && argc > 0) {
+            budget_mb = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+        } else {
+            usage = true;
+        }
+    }
+    usage |= world_width < 2 || world_height < 2;
+    // A streamed world carries on from wherever it was left, which neither
+    // matches a recording nor fits in the frames the sim thread publishes.
+    usage |= stream_path && (record_path || replay_path || sim_thread);
+    if (usage) {
+        fprintf(stderr, "Usage: %s [-threads N] [-deterministic] [-in-place] [-seed S] [-record FILE | -replay FILE] [-prof-csv FILE] [-sim-thread] [-catch-up N] [-overload drop|degrade] [-world WxH] [-stream FILE [-budget MB]]\n", program);
+        fprintf(stderr, "    -world WxH     size of the world in cells, the arrow keys move the view around it\n");
+        fprintf(stderr, "    -stream FILE   keep the world in FILE, created if missing, only paging in what is around the view\n");
+        fprintf(stderr, "    -budget MB     memory to keep the streamed world in, default %d\n", STREAM_DEFAULT_BUDGET_MB);
+        return 1;
+    }
+
+    prof.enabled = true;
+    if (prof_csv_path && !prof_open_csv(prof_csv_path)) return 1;
+    bool show_prof = false;
+
+    Recording recording = {0};
+    if (replay_path) {
+        if (!recording_load(&recording, replay_path)) return 1;
+        seed = recording.seed;
+        // The recorded settings win, the replay would not match otherwise.
+        if (!recording_matches(&recording, engine, threads, deterministic)) {
+            nob_log(NOB_WARNING, "%s was recorded with other engine or threading options, replaying with those", replay_path);
+        }
+        engine = recording.engine;
+        threads = recording.threads;
+        deterministic = recording.deterministic;
+    }
+
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Falling Sand");
 
     SetTargetFPS(0);
 
     #ifdef FIXED_UPDATE
-    float accumulator = 0.0f;
-    float current_time = GetTime();
     const float physics_fps = 62.0f;
     const float fixed_update_time = 1.0f / physics_fps;
     #endif // FIXED_UPDATE
@@ -400,116 +317,191 @@ int main(void)
     float click_radius = 10;
     float scroll_speed = 10;
 
-    int updates;
-
-    World *world = world_new(SCREEN_WIDTH, SCREEN_HEIGHT, SCREEN_SCALE);
-    // TODO: Use arenas
+    const double scale = SCREEN_SCALE;
+    const size_t view_width = SCREEN_WIDTH / scale;
+    const size_t view_height = SCREEN_HEIGHT / scale;
+    Stream stream = {0};
+    World *world = NULL;
+    if (replay_path) {
+        world = world_new(recording.width, recording.height);
+    } else if (stream_path) {
+        world = stream_open(&stream, stream_path, world_width, world_height, budget_mb * 1024 * 1024);
+        if (!world) return 1;
+    } else {
+        world = world_new(world_width, world_height);
+    }
+    world_configure(world, engine, threads, deterministic);
+    // A streamed world keeps the seed it was created with.
+    if (!stream_path || world->tick == 0) world_set_seed(world, seed);
+    if (sim_thread && (world->width > view_width || world->height > view_height)) {
+        nob_log(NOB_ERROR, "-sim-thread needs a world that fits on screen, %zux%zu at most", view_width, view_height);
+        return 1;
+    }
+    // Only the region around the view ticks, and where the view went is not
+    // recorded, so a replay would not tick the same chunks.
+    if ((record_path || replay_path) && (world->width > view_width || world->height > view_height)) {
+        nob_log(NOB_ERROR, "-record and -replay need a world that fits on screen, %zux%zu at most", view_width, view_height);
+        return 1;
+    }
+    if (record_path) {
+        recording = (Recording) {
+            .width = world->width,
+            .height = world->height,
+            .seed = seed,
+            .engine = engine,
+            .threads = threads,
+            .deterministic = deterministic,
+        };
+    }
+    Canvas canvas = canvas_new(world, view_width, view_height);
+    // Top left cell of the view.
+    Vector2 camera = {0};
+
+    // While replaying, the brush is driven by the recording until it ends.
+    Sim sim;
+    sim_init(&sim, world);
+    sim.recording = &recording;
+    sim.recording_input = record_path != NULL;
+    sim.replaying = replay_path != NULL;
+    #ifdef FIXED_UPDATE
+    sched_init(&sim.sched, fixed_update_time, max_catch_up, overload);
+    #else // FIXED_UPDATE
+    sched_init(&sim.sched, 1.0 / 60.0, max_catch_up, overload);
+    #endif // FIXED_UPDATE
+    if (sim_thread) sim_start(&sim);
+    const Sim_Frame *frame = NULL;
+    bool frame_fresh = false;
+    size_t brush_tick = 0;
+    // Where the last brush event ended, new ones start there while the
+    // button stays down.
+    bool brush_held = false;
+    Vector2 brush_last = {0};
 
     while (!WindowShouldClose()) {
-        mouse_pos = Vector2Scale(GetMousePosition(), (float)1/(float)world->scale);
-
-        #ifdef FIXED_UPDATE
-        float new_time = GetTime();
-        float frame_time = new_time - current_time;
-        current_time = new_time;
-        accumulator += frame_time;
-        while (accumulator >= fixed_update_time)
-        {
-            #endif // FIXED_UPDATE
-
-            //update particles
-
-            for (size_t y = world->height - 1; y > 0; --y) {
-                for (size_t x = 0; x < world->width; ++x) {
-                    Particle p = world_get_at(world, x, y);
-                    if (p.props != PP_NONE) {
-                        if (p.props & PP_MOVE_DOWN || p.props & PP_MOVE_DOWN_SIDE) {
-                            p.free_falling = true;
-                        }
-                        if ((p.props & PP_MOVE_DOWN) && world_move_down(world, x, y)) {
-                            p.free_falling = true;
-                        }
-                        else if ((p.props & PP_MOVE_DOWN_SIDE) && world_move_down_side(world, x, y)) {
-                            p.velocity = (Vector2){ .x = p.velocity.x, .y = 0 };
-                        }
-                        else if ((p.props & PP_MOVE_SIDE) && world_move_side(world, x, y)) {}
-                    }
-                    world_set_particle(world, x, y, p);
+        // The sim thread only runs worlds that fit on screen, the view never
+        // moves there.
+        if (!sim.threaded) {
+            Vector2 pan = {
+                .x = IsKeyDown(KEY_RIGHT) - IsKeyDown(KEY_LEFT),
+                .y = IsKeyDown(KEY_DOWN) - IsKeyDown(KEY_UP),
+            };
+            camera = Vector2Add(camera, Vector2Scale(pan, CAMERA_SPEED * GetFrameTime()));
+            camera.x = Clamp(camera.x, 0, world->width - canvas.view.width);
+            camera.y = Clamp(camera.y, 0, world->height - canvas.view.height);
+
+            world_set_region(world, canvas_region(&canvas, camera));
+            if (stream_path) stream_update(&stream);
+        }
+        Vector2 view_pos = { .x = (int)camera.x, .y = (int)camera.y };
+        mouse_pos = Vector2Add(Vector2Scale(GetMousePosition(), (float)1/(float)scale), view_pos);
+
+        bool brush_down = IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_RIGHT);
+        if (!brush_down) brush_held = false;
+        Brush_Event brush = {
+            .x = mouse_pos.x,
+            .y = mouse_pos.y,
+            .from_x = brush_held ? brush_last.x : mouse_pos.x,
+            .from_y = brush_held ? brush_last.y : mouse_pos.y,
+            .radius = click_radius,
+            .type = selected,
+            .op = IsMouseButtonDown(MOUSE_BUTTON_LEFT) ? BRUSH_PAINT : BRUSH_ERASE,
+        };
+
+        if (sim.threaded) {
+            // One brush event per tick, as in the loop below.
+            frame = sim_acquire(&sim, &frame_fresh);
+            if (brush_down && frame->stats.ticks != brush_tick) {
+                if (sim_push_brush(&sim, brush)) {
+                    brush_tick = frame->stats.ticks;
+                    brush_held = true;
+                    brush_last = mouse_pos;
                 }
             }
-            updates = world->particle_updates.count;
-            world_update_particles(world);
-
-            if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
-                for (int i = -click_radius; i < click_radius; ++i) {
-                    for (int j = -click_radius; j < click_radius; ++j) {
-                        Vector2 offset = { .x = i, .y = j };
-                        Vector2 hovered = { .x = mouse_pos.x, .y = mouse_pos.y };
-                        size_t new_x = (size_t)mouse_pos.x + i;
-                        size_t new_y = (size_t)mouse_pos.y + j;
-                        if (
-                        Vector2DistanceSqr(hovered, Vector2Add(hovered, offset)) <= click_radius * click_radius &&
-                        GetRandomValue(1, particle_chance(selected)) == 1 &&
-                        world_is_empty(world, new_x, new_y)
-                        ) {
-                            Particle p = world_get_at(world, new_x, new_y);
-                            particle_set(&p, selected);
-                            world_set_particle(world, new_x, new_y, p);
-                        }
-                    }
-                }
-            } else if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
-                for (int i = -click_radius; i < click_radius; ++i) {
-                    for (int j = -click_radius; j < click_radius; ++j) {
-                        Vector2 offset = { .x = i, .y = j };
-                        Vector2 hovered = { .x = mouse_pos.x, .y = mouse_pos.y };
-                        size_t new_x = (size_t)mouse_pos.x + i;
-                        size_t new_y = (size_t)mouse_pos.y + j;
-                        if (Vector2DistanceSqr(hovered, Vector2Add(hovered, offset)) <= click_radius*click_radius &&
-
-                        world_in_bounds(world, new_x, new_y)) {
-                            Particle p = world_get_at(world, new_x, new_y);
-                            particle_set(&p, PT_EMPTY);
-                            world_set_particle(world, new_x, new_y, p);
-                        }
-                    }
+        } else {
+            #ifdef FIXED_UPDATE
+            size_t due = sched_update(&sim.sched, GetTime());
+            #else // FIXED_UPDATE
+            size_t due = 1;
+            #endif // FIXED_UPDATE
+            for (size_t i = 0; i < due; ++i) {
+                //update particles
+
+                if (brush_down && sim_push_brush(&sim, brush)) {
+                    brush_held = true;
+                    brush_last = mouse_pos;
+                    brush.from_x = brush.x;
+                    brush.from_y = brush.y;
                 }
+                sim_step(&sim);
             }
-
-            #ifdef FIXED_UPDATE
-            accumulator -= fixed_update_time;
         }
-        #endif // FIXED_UPDATE
 
         //input
 
-        if (IsKeyDown(KEY_ONE)) selected = PT_SAND;
-        if (IsKeyDown(KEY_TWO)) selected = PT_WATER;
-        if (IsKeyDown(KEY_THREE)) selected = PT_STONE;
+        // Keys 1..9 pick the materials in table order.
+        for (size_t type = PT_EMPTY + 1; type < PT_COUNT && type <= 9; ++type) {
+            if (IsKeyDown(KEY_ZERO + type)) selected = type;
+        }
+
+        if ((IsKeyPressed(KEY_F5) || IsKeyPressed(KEY_F9)) && sim.threaded) {
+            nob_log(NOB_WARNING, "snapshots are not available with -sim-thread");
+        } else if ((IsKeyPressed(KEY_F5) || IsKeyPressed(KEY_F9)) && stream_path) {
+            nob_log(NOB_WARNING, "snapshots are not available with -stream, the world is saved to %s as it runs", stream_path);
+        } else if (IsKeyPressed(KEY_F5)) {
+            if (world_save(world, SNAPSHOT_PATH, SNAPSHOT_RLE)) {
+                nob_log(NOB_INFO, "saved world to %s", SNAPSHOT_PATH);
+            }
+        }
+        else if (IsKeyPressed(KEY_F9) && (record_path || replay_path)) {
+            nob_log(NOB_WARNING, "can not load a snapshot while recording or replaying");
+        } else if (IsKeyPressed(KEY_F9)) {
+            World *loaded = world_load(SNAPSHOT_PATH);
+            if (loaded) {
+                nob_log(NOB_INFO, "loaded world from %s", SNAPSHOT_PATH);
+                world_configure(loaded, engine, threads, deterministic);
+                if (loaded->width != world->width || loaded->height != world->height) {
+                    canvas_free(&canvas);
+                    canvas = canvas_new(loaded, view_width, view_height);
+                    camera = (Vector2) {0};
+                }
+                // Loaded with the whole world as its region, which has more
+                // chunks than the canvas has rects for.
+                world_set_region(loaded, canvas_region(&canvas, camera));
+                world_free(world);
+                world = loaded;
+                sim.world = world;
+            }
+        }
+
+        if (IsKeyPressed(KEY_F3)) show_prof = !show_prof;
 
         float wheel = GetMouseWheelMove();
         if (wheel < 0) {
-            click_radius -= scroll_speed;
+            click_radius = brush_clamp_radius(click_radius - scroll_speed);
         } else if (wheel > 0) {
-            click_radius += scroll_speed;
+            click_radius = brush_clamp_radius(click_radius + scroll_speed);
         }
 
 
         BeginDrawing();
         ClearBackground(BLACK);
 
-        world_update_image_data(world);
-        UpdateTexture(world->texture, world->image_data);
+        if (sim.threaded) {
+            if (frame_fresh) canvas_upload_frame(&canvas, world, frame);
+        } else {
+            canvas_update(&canvas, world, view_pos.x, view_pos.y);
+        }
 
+        uint64_t draw_start = prof_begin();
         DrawTexturePro(
-        world->texture,
+        canvas.texture,
         (Rectangle){
-            .width = world->width,
-            .height = world->height
+            .width = canvas.view.width,
+            .height = canvas.view.height
         },
         (Rectangle){
-            .width = world->width * world->scale,
-            .height = world->height * world->scale,
+            .width = canvas.view.width * scale,
+            .height = canvas.view.height * scale,
         },
         (Vector2){0, 0},
         0.0f,
@@ -517,28 +509,54 @@ int main(void)
         );
         //board_draw(board);
         #ifdef FIXED_UPDATE
-        DrawText(TextFormat("Physics FPS: %.f   FPS: %d", physics_fps, GetFPS()), 0, 0, 25, WHITE);
+        DrawText(TextFormat("Physics FPS: %.f/%.f   FPS: %d", prof_tick_rate(60), physics_fps, GetFPS()), 0, 0, 25, WHITE);
         #else // FIXED_UPDATE
         DrawText(TextFormat("FPS: %d", GetFPS()), 0, 0, 25, WHITE);
         #endif // FIXED_UPDATE
-        DrawText(TextFormat("Material: %s", PARTICLE_TYPE_NAMES[selected]), 0, 25, 25, WHITE);
+        DrawText(TextFormat("Material: %s", MATERIALS[selected].name), 0, 25, 25, WHITE);
         DrawText(TextFormat("x: %.f, y: %.f", mouse_pos.x, mouse_pos.y), 0, 50, 25, WHITE);
-        DrawText(TextFormat("Updates: %d",updates), 0, 75, 25,WHITE);
-        size_t sum = 0;
-        for (size_t i = 0; i < world->width * world-> height; ++i) {
-            if (world->particles[i].type != PT_EMPTY) ++sum;
+        // The world belongs to the sim thread while it runs.
+        World_Stats stats = sim.threaded ? frame->stats : world_get_stats(world);
+        DrawText(TextFormat("Updates: %zu   Moved: %zu", stats.updates, stats.moved), 0, 75, 25,WHITE);
+        DrawText(TextFormat("Particles: %zu   Settled: %zu", stats.particles, stats.settled), 0, 100, 25,WHITE);
+        DrawText(TextFormat("Chunks: %zu/%zu", stats.active_chunks, world->chunks_width * world->chunks_height), 0, 125, 25,WHITE);
+        DrawText(TextFormat("Skipped: %zu   Merged: %zu", stats.skipped_ticks, stats.merged_ticks), 0, 150, 25,WHITE);
+        if (stream_path) {
+            DrawText(TextFormat("Resident: %zu/%zu MB   Paged out: %zu", stream.resident * stream.band_size >> 20, stream.budget >> 20, stream.paged_out), 0, 175, 25,WHITE);
         }
-        DrawText(TextFormat("Particles: %d",sum), 0, 100, 25,WHITE);
         DrawCircle(
-        mouse_pos.x * world->scale,
-        mouse_pos.y * world->scale,
-        click_radius * world->scale,
+        (mouse_pos.x - view_pos.x) * scale,
+        (mouse_pos.y - view_pos.y) * scale,
+        click_radius * scale,
         (Color){ .r = 255, .g = 255, .b = 255, .a = 50 }
         );
+        #ifdef FIXED_UPDATE
+        if (show_prof) prof_draw_overlay(SCREEN_WIDTH - 430, 0, fixed_update_time);
+        #else // FIXED_UPDATE
+        if (show_prof) prof_draw_overlay(SCREEN_WIDTH - 430, 0, 1.0f / 60.0f);
+        #endif // FIXED_UPDATE
         EndDrawing();
+        prof_end(PROF_DRAW, draw_start);
+        prof_commit();
     }
 
-    world_free(world);
+    prof_close_csv();
+
+    sim_free(&sim);
+    if (record_path) {
+        recording.ticks = world->tick;
+        if (recording_save(&recording, record_path)) {
+            nob_log(NOB_INFO, "recorded %zu ticks to %s, checksum %016" PRIx64, recording.ticks, record_path, world_checksum(world));
+        }
+    }
+    recording_free(&recording);
+
+    canvas_free(&canvas);
+    if (stream_path) {
+        if (stream_close(&stream)) nob_log(NOB_INFO, "saved world to %s", stream_path);
+    } else {
+        world_free(world);
+    }
 
     CloseWindow();
     return 0;
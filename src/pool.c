@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "pool.h"
+
+static void pool_drain(Pool *pool, Pool_Job job, void *ctx, size_t count, size_t worker)
+{
+    for (;;) {
+        size_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= count) break;
+        job(ctx, i, worker);
+    }
+}
+
+static void *pool_thread(void *arg)
+{
+    Pool_Thread *self = arg;
+    Pool *pool = self->pool;
+    size_t seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        if (pool->quit) break;
+        seen = pool->generation;
+
+        Pool_Job job = pool->job;
+        void *ctx = pool->ctx;
+        size_t count = pool->count;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool_drain(pool, job, ctx, count, self->id);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running -= 1;
+        if (pool->running == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+Pool *pool_new(size_t threads)
+{
+    if (threads < 1) threads = 1;
+
+    Pool *pool = malloc(sizeof(Pool));
+    assert(pool && "Could not allocate pool");
+    memset(pool, 0, sizeof(*pool));
+
+    pool->threads = threads;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->workers = malloc(sizeof(Pool_Thread) * threads);
+    assert(pool->workers && "Could not allocate pool workers");
+
+    // Worker 0 is whoever calls pool_run(), only the rest get a thread.
+    for (size_t i = 0; i < threads; ++i) {
+        pool->workers[i] = (Pool_Thread) { .pool = pool, .id = i };
+        if (i == 0) continue;
+        int ret = pthread_create(&pool->workers[i].handle, NULL, pool_thread, &pool->workers[i]);
+        assert(ret == 0 && "Could not start pool thread");
+    }
+
+    return pool;
+}
+
+void pool_free(Pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 1; i < pool->threads; ++i) {
+        pthread_join(pool->workers[i].handle, NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->workers);
+    free(pool);
+}
+
+void pool_run(Pool *pool, size_t count, Pool_Job job, void *ctx)
+{
+    if (count == 0) return;
+
+    if (pool->threads == 1) {
+        for (size_t i = 0; i < count; ++i) job(ctx, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = job;
+    pool->ctx = ctx;
+    pool->count = count;
+    pool->next = 0;
+    pool->running = pool->threads - 1;
+    pool->generation += 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool_drain(pool, job, ctx, count, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,47 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Called once for every index of a pool_run() batch. `worker` is the id of the
+// thread running it, in [0, pool->threads), and stays fixed for the call.
+typedef void (*Pool_Job)(void *ctx, size_t index, size_t worker);
+
+// A fixed set of worker threads that sleep until handed a batch of indices.
+// The calling thread takes part in every batch as worker 0.
+typedef struct Pool Pool;
+
+typedef struct Pool_Thread {
+    Pool *pool;
+    size_t id;
+    pthread_t handle;
+} Pool_Thread;
+
+struct Pool {
+    size_t threads;
+    Pool_Thread *workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+
+    // Current batch, guarded by mutex except for `next` which workers take
+    // indices from atomically.
+    Pool_Job job;
+    void *ctx;
+    size_t count;
+    size_t next;
+    size_t generation;
+    size_t running;
+    bool quit;
+};
+
+Pool *pool_new(size_t threads);
+void pool_free(Pool *pool);
+
+// Run job(ctx, i, worker) for every i in [0, count) and wait for all of them.
+void pool_run(Pool *pool, size_t count, Pool_Job job, void *ctx);
+
+#endif // POOL_H_
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "nob.h"
+
+#include "prof.h"
+
+const char *PROF_PHASE_NAMES[PROF_COUNT] = {
+    [PROF_SWEEP]       = "sweep",
+    [PROF_FILTER]      = "filter",
+    [PROF_SHUFFLE]     = "shuffle",
+    [PROF_RESOLVE]     = "resolve",
+    [PROF_BRUSH]       = "brush",
+    [PROF_COPY_COLORS] = "copy_colors",
+    [PROF_UPLOAD]      = "upload",
+    [PROF_DRAW]        = "draw",
+    [PROF_FRAME]       = "frame",
+};
+
+Prof prof = {0};
+
+uint64_t prof_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+void prof_reset(void)
+{
+    memset(&prof.current, 0, sizeof(prof.current));
+    prof.current_start = prof_now();
+    prof.head = 0;
+    prof.count = 0;
+    prof.samples = 0;
+}
+
+void prof_tick(void)
+{
+    __atomic_fetch_add(&prof.current.ticks, 1, __ATOMIC_RELAXED);
+}
+
+void prof_commit(void)
+{
+    if (!prof.enabled) return;
+
+    // Taken apart field by field, a sim thread may still be adding to it.
+    Prof_Sample sample = {0};
+    for (size_t i = 0; i < PROF_COUNT; ++i) sample.ns[i] = __atomic_exchange_n(&prof.current.ns[i], 0, __ATOMIC_RELAXED);
+    sample.ticks = __atomic_exchange_n(&prof.current.ticks, 0, __ATOMIC_RELAXED);
+
+    uint64_t now = prof_now();
+    if (prof.current_start != 0) sample.ns[PROF_FRAME] = now - prof.current_start;
+    prof.current_start = now;
+
+    if (prof.csv) {
+        fprintf(prof.csv, "%zu,%u", prof.samples, sample.ticks);
+        for (size_t i = 0; i < PROF_COUNT; ++i) fprintf(prof.csv, ",%" PRIu64, sample.ns[i]);
+        fprintf(prof.csv, "\n");
+    }
+    prof.samples += 1;
+
+    prof.history[prof.head] = sample;
+    prof.head = (prof.head + 1) % PROF_HISTORY;
+    if (prof.count < PROF_HISTORY) prof.count += 1;
+}
+
+bool prof_open_csv(const char *path)
+{
+    prof_close_csv();
+    prof.csv = fopen(path, "w");
+    if (!prof.csv) {
+        nob_log(NOB_ERROR, "could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    fprintf(prof.csv, "sample,ticks");
+    for (size_t i = 0; i < PROF_COUNT; ++i) fprintf(prof.csv, ",%s_ns", PROF_PHASE_NAMES[i]);
+    fprintf(prof.csv, "\n");
+    return true;
+}
+
+void prof_close_csv(void)
+{
+    if (prof.csv) fclose(prof.csv);
+    prof.csv = NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t prof_percentile(Prof_Phase phase, double p)
+{
+    if (prof.count == 0) return 0;
+
+    uint64_t values[PROF_HISTORY];
+    for (size_t i = 0; i < prof.count; ++i) values[i] = prof.history[i].ns[phase];
+    qsort(values, prof.count, sizeof(*values), compare_u64);
+
+    size_t rank = p * (prof.count - 1) + 0.5;
+    return values[rank < prof.count ? rank : prof.count - 1];
+}
+
+const Prof_Sample *prof_sample(size_t i)
+{
+    if (i >= prof.count) return NULL;
+    return &prof.history[(prof.head + PROF_HISTORY - 1 - i) % PROF_HISTORY];
+}
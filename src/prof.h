@@ -0,0 +1,92 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Wall clock time spent in each phase of the hot path. Time is added up into
+// the current sample until prof_commit() pushes it into a ring buffer of
+// recent samples; main commits once per frame, bench once per tick.
+//
+// Phases run by the worker pool add the time of every worker, so in parallel
+// mode they count CPU time rather than elapsed time.
+typedef enum Prof_Phase {
+    PROF_SWEEP,        // visiting cells and queueing or making moves
+    PROF_FILTER,       // world_update_particles(): dropping blocked intents
+    PROF_SHUFFLE,      // world_update_particles(): shuffling intents
+    PROF_RESOLVE,      // world_update_particles(): walking intents
+    PROF_BRUSH,        // painting and erasing
+    PROF_COPY_COLORS,  // world_copy_colors() of the changed rects
+    PROF_UPLOAD,       // UpdateTextureRec() of the changed rects
+    PROF_DRAW,         // everything between BeginDrawing() and EndDrawing()
+    PROF_FRAME,        // the whole sample
+    PROF_COUNT
+} Prof_Phase;
+
+extern const char *PROF_PHASE_NAMES[PROF_COUNT];
+
+#define PROF_HISTORY 512
+
+typedef struct Prof_Sample {
+    uint64_t ns[PROF_COUNT];
+    // Simulation ticks that ran during the sample.
+    uint32_t ticks;
+} Prof_Sample;
+
+typedef struct Prof {
+    // Timers cost a clock read each while enabled and nothing otherwise.
+    bool enabled;
+    Prof_Sample current;
+    uint64_t current_start;
+
+    Prof_Sample history[PROF_HISTORY];
+    size_t head;  // next slot to write
+    size_t count;
+
+    // Every committed sample is also written here as a CSV row, when set.
+    FILE *csv;
+    size_t samples;
+} Prof;
+
+extern Prof prof;
+
+uint64_t prof_now(void);
+
+static inline uint64_t prof_begin(void)
+{
+    return prof.enabled ? prof_now() : 0;
+}
+
+static inline void prof_end(Prof_Phase phase, uint64_t start)
+{
+    if (prof.enabled) __atomic_fetch_add(&prof.current.ns[phase], prof_now() - start, __ATOMIC_RELAXED);
+}
+
+// Time the statement or block that follows, which must not return or break
+// out of it:
+//
+//     PROF_SCOPE(PROF_DRAW) {
+//         ...
+//     }
+#define PROF_SCOPE(phase) \
+    for (uint64_t prof_scope_start = prof_begin(), prof_scope_once = 1; \
+         prof_scope_once; \
+         prof_scope_once = 0, prof_end((phase), prof_scope_start))
+
+// Drop the history and start a new first sample now.
+void prof_reset(void);
+void prof_tick(void);
+// Close the current sample, PROF_FRAME is the time since the last commit.
+void prof_commit(void);
+
+bool prof_open_csv(const char *path);
+void prof_close_csv(void);
+
+// Percentile `p` in [0, 1] of a phase over the samples in the ring buffer.
+uint64_t prof_percentile(Prof_Phase phase, double p);
+// The i-th most recent sample, 0 being the last one committed.
+const Prof_Sample *prof_sample(size_t i);
+
+#endif // PROF_H_
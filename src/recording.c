@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "nob.h"
+
+#include "recording.h"
+#include "brush.h"
+#include "snapshot.h"
+
+void recording_apply(World *world, Brush_Event event)
+{
+    Particle_Type type = event.op == BRUSH_ERASE ? PT_EMPTY : event.type;
+    brush_stroke(world, event.from_x, event.from_y, event.x, event.y, event.radius, type);
+}
+
+void recording_play(const Recording *recording, size_t *cursor, World *world)
+{
+    while (*cursor < recording->count && recording->items[*cursor].tick <= world->tick) {
+        recording_apply(world, recording->items[*cursor]);
+        *cursor += 1;
+    }
+}
+
+bool recording_matches(const Recording *recording, World_Engine engine, size_t threads, bool deterministic)
+{
+    if (recording->engine != engine || (recording->threads > 0) != (threads > 0)) return false;
+    if (threads == 0) return true;
+    // Deterministic runs come out the same on any number of threads.
+    if (recording->deterministic && deterministic) return true;
+    return !recording->deterministic && !deterministic && recording->threads == threads;
+}
+
+static bool recording_event_valid(Brush_Event event)
+{
+    return event.type < PT_COUNT && event.op <= BRUSH_ERASE
+        && isfinite(event.x) && isfinite(event.y) && isfinite(event.from_x) && isfinite(event.from_y)
+        && isfinite(event.radius) && event.radius > 0 && event.radius <= BRUSH_MAX_RADIUS;
+}
+
+bool recording_save(const Recording *recording, const char *path)
+{
+    Recording_Header header = {
+        .magic = RECORDING_MAGIC,
+        .version = RECORDING_VERSION,
+        .width = recording->width,
+        .height = recording->height,
+        .seed = recording->seed,
+        .ticks = recording->ticks,
+        .events = recording->count,
+        .engine = recording->engine,
+        .threads = recording->threads,
+        .deterministic = recording->deterministic,
+    };
+
+    Nob_String_Builder sb = {0};
+    nob_sb_append_buf(&sb, &header, sizeof(header));
+    nob_sb_append_buf(&sb, recording->items, recording->count * sizeof(Brush_Event));
+    bool result = nob_write_entire_file(path, sb.items, sb.count);
+    nob_sb_free(sb);
+    return result;
+}
+
+bool recording_load(Recording *recording, const char *path)
+{
+    Nob_String_Builder sb = {0};
+    if (!nob_read_entire_file(path, &sb)) return false;
+
+    Recording_Header header;
+    if (sb.count < sizeof(header)) {
+        nob_log(NOB_ERROR, "%s is not a recording", path);
+        nob_sb_free(sb);
+        return false;
+    }
+    memcpy(&header, sb.items, sizeof(header));
+    if (memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0 || header.version != RECORDING_VERSION) {
+        nob_log(NOB_ERROR, "%s is not a version %d recording", path, RECORDING_VERSION);
+        nob_sb_free(sb);
+        return false;
+    }
+    uint64_t cells = (uint64_t)header.width * header.height;
+    if (header.width == 0 || header.height == 0 || cells > SNAPSHOT_MAX_CELLS || cells > SIZE_MAX / 8 || header.engine > WORLD_ENGINE_IN_PLACE || header.events != (sb.count - sizeof(header)) / sizeof(Brush_Event)) {
+        nob_log(NOB_ERROR, "recording %s is truncated or corrupt", path);
+        nob_sb_free(sb);
+        return false;
+    }
+
+    *recording = (Recording) {
+        .width = header.width,
+        .height = header.height,
+        .seed = header.seed,
+        .ticks = header.ticks,
+        .engine = header.engine,
+        .threads = header.threads,
+        .deterministic = header.deterministic != 0,
+    };
+    nob_da_append_many(recording, (Brush_Event *)(sb.items + sizeof(header)), header.events);
+    nob_sb_free(sb);
+
+    for (size_t i = 0; i < recording->count; ++i) {
+        if (!recording_event_valid(recording->items[i])) {
+            nob_log(NOB_ERROR, "recording %s is truncated or corrupt", path);
+            recording_free(recording);
+            return false;
+        }
+    }
+    return true;
+}
+
+void recording_free(Recording *recording)
+{
+    nob_da_free(*recording);
+    *recording = (Recording) {0};
+}
@@ -0,0 +1,85 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "world.h"
+
+// A recording is everything the user did to a world, tick by tick, so a
+// session can be replayed exactly. It starts from an empty world of the
+// recorded size and seed, and a replay steps the same number of ticks and
+// applies every brush event right after the tick it was recorded at. The
+// result only matches when the replay uses the same engine and threading
+// options (or -deterministic on both sides), so those are recorded as well.
+//
+// The file is a Recording_Header followed by the events, in host byte order.
+// Neither has any padding, every byte written is one of their fields.
+#define RECORDING_MAGIC   "FREC"
+#define RECORDING_VERSION 3
+
+typedef enum Brush_Op : uint8_t {
+    BRUSH_PAINT = 0,
+    BRUSH_ERASE,
+} Brush_Op;
+
+// A stroke of the brush from where it was on the previous tick, the same
+// position if it was not down then.
+typedef struct Brush_Event {
+    uint32_t tick;
+    float x;
+    float y;
+    float from_x;
+    float from_y;
+    float radius;
+    uint8_t type;  // Particle_Type, ignored when erasing
+    uint8_t op;    // Brush_Op
+    uint8_t reserved[2];
+} Brush_Event;
+static_assert(sizeof(Brush_Event) == 28, "brush events are written as they are");
+
+typedef struct Recording_Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t seed;
+    uint64_t ticks;
+    uint64_t events;
+    uint32_t engine;        // World_Engine
+    uint32_t threads;       // 0 for the serial sweep
+    uint32_t deterministic;
+    uint32_t reserved;
+} Recording_Header;
+static_assert(sizeof(Recording_Header) == 56, "recording headers are written as they are");
+
+typedef struct Recording {
+    size_t width;
+    size_t height;
+    uint64_t seed;
+    // Length of the run in ticks.
+    size_t ticks;
+    // Settings of the world that was recorded.
+    World_Engine engine;
+    size_t threads;
+    bool deterministic;
+
+    Brush_Event *items;
+    size_t count;
+    size_t capacity;
+} Recording;
+
+void recording_apply(World *world, Brush_Event event);
+// Apply the events of the world's current tick. `cursor` is the index of the
+// next event to apply, start it at 0.
+void recording_play(const Recording *recording, size_t *cursor, World *world);
+
+// Whether a world with these settings steps the same way as the recorded one.
+bool recording_matches(const Recording *recording, World_Engine engine, size_t threads, bool deterministic);
+
+bool recording_save(const Recording *recording, const char *path);
+bool recording_load(Recording *recording, const char *path);
+void recording_free(Recording *recording);
+
+#endif // RECORDING_H_
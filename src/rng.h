@@ -0,0 +1,74 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Small xorshift64* generator. Every world and every worker owns one, so the
+// hot path never touches shared state and a run is reproducible from its seed.
+typedef struct Rng {
+    uint64_t state;
+    // Buffered output for rng_bit()/rng_bits(), most choices in the
+    // simulation only need a bit or two.
+    uint64_t bits;
+    uint32_t bits_left;
+} Rng;
+
+// splitmix64, used to turn arbitrary seeds (including 0) into a usable state.
+static inline uint64_t rng_mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static inline void rng_seed(Rng *rng, uint64_t seed)
+{
+    rng->state = rng_mix(seed);
+    if (rng->state == 0) rng->state = 1;
+    rng->bits = 0;
+    rng->bits_left = 0;
+}
+
+static inline uint64_t rng_next(Rng *rng)
+{
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// The next `count` (at most 32) random bits.
+static inline uint32_t rng_bits(Rng *rng, uint32_t count)
+{
+    if (rng->bits_left < count) {
+        rng->bits = rng_next(rng);
+        rng->bits_left = 64;
+    }
+    uint32_t result = (uint32_t)(rng->bits & ((1ull << count) - 1));
+    rng->bits >>= count;
+    rng->bits_left -= count;
+    return result;
+}
+
+static inline bool rng_bit(Rng *rng)
+{
+    return rng_bits(rng, 1);
+}
+
+// Uniform in [0, n), without a division.
+static inline uint32_t rng_below(Rng *rng, uint32_t n)
+{
+    return (uint32_t)(((rng_next(rng) >> 32) * n) >> 32);
+}
+
+// Uniform in [0, 1).
+static inline float rng_float(Rng *rng)
+{
+    return (rng_next(rng) >> 40) * (1.0f / (1 << 24));
+}
+
+#endif // RNG_H_
@@ -0,0 +1,63 @@
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "sched.h"
+
+void sched_init(Sched *sched, double tick_time, size_t max_catch_up, Sched_Policy policy)
+{
+    *sched = (Sched) {
+        .policy = policy,
+        .tick_time = tick_time,
+        .max_catch_up = max_catch_up > 0 ? max_catch_up : 1,
+        .rate = 1.0,
+    };
+}
+
+size_t sched_update(Sched *sched, double now)
+{
+    if (!sched->started) {
+        sched->started = true;
+        sched->last = now;
+    }
+    double elapsed = now - sched->last;
+    sched->last = now;
+    if (elapsed > SCHED_MAX_ELAPSED) elapsed = SCHED_MAX_ELAPSED;
+    if (elapsed < 0) elapsed = 0;
+    sched->accumulator += elapsed;
+
+    double tick_time = sched->tick_time / sched->rate;
+    size_t due = sched->accumulator / tick_time;
+
+    if (due > sched->max_catch_up) {
+        size_t excess = due - sched->max_catch_up;
+        sched->accumulator -= excess * tick_time;
+        due = sched->max_catch_up;
+        // Thrown away under either policy, counted in wall clock ticks.
+        sched->skipped += excess / sched->rate + 0.5;
+
+        if (sched->policy == SCHED_DEGRADE) {
+            sched->calm = 0;
+            if (sched->rate > SCHED_MIN_RATE) sched->rate *= 0.5;
+        }
+    } else if (sched->policy == SCHED_DEGRADE && sched->rate < 1.0) {
+        sched->calm += elapsed;
+        if (sched->calm >= 1.0) {
+            sched->calm = 0;
+            sched->rate *= 2.0;
+            if (sched->rate > 1.0) sched->rate = 1.0;
+        }
+    }
+
+    // Each degraded tick covers 1/rate ticks of wall time.
+    if (sched->rate < 1.0) sched->merged += due * (1.0 / sched->rate - 1.0) + 0.5;
+
+    sched->accumulator -= due * tick_time;
+    return due;
+}
+
+double sched_next(Sched *sched)
+{
+    double tick_time = sched->tick_time / sched->rate;
+    double left = tick_time - sched->accumulator;
+    return sched->last + (left > 0 ? left : 0);
+}
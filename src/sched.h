@@ -0,0 +1,54 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Fixed timestep scheduler: turns elapsed wall time into a number of ticks to
+// run. It never asks for more than `max_catch_up` ticks at once, so a tick
+// that costs more than its slot can not snowball into ever longer frames.
+// What happens to the time it could not catch up on depends on the policy.
+typedef enum Sched_Policy {
+    // Throw the time away, the simulation falls behind the wall clock and
+    // runs in slow motion for as long as it is overloaded.
+    SCHED_DROP = 0,
+    // Lower the tick rate, halving it each time the cap is hit and doubling
+    // it again after a second without trouble. Every tick then stands for
+    // several ticks of wall time, so the slow motion is even instead of
+    // bursty and the frames in between get time to render.
+    SCHED_DEGRADE,
+} Sched_Policy;
+
+#define SCHED_DEFAULT_CATCH_UP 4
+
+// The tick rate never drops below this fraction of the target.
+#define SCHED_MIN_RATE (1.0 / 8.0)
+// Longest gap between two updates that still counts as time owed, anything
+// longer (a dragged window, a debugger) is forgotten rather than caught up.
+#define SCHED_MAX_ELAPSED 0.25
+
+typedef struct Sched {
+    Sched_Policy policy;
+    double tick_time;
+    size_t max_catch_up;
+
+    double accumulator;
+    double last;
+    bool started;
+    // Fraction of the target tick rate currently in use.
+    double rate;
+    double calm;
+
+    // Wall clock ticks thrown away at the cap, under either policy, and
+    // wall clock ticks folded into slower ticks by SCHED_DEGRADE.
+    size_t skipped;
+    size_t merged;
+} Sched;
+
+void sched_init(Sched *sched, double tick_time, size_t max_catch_up, Sched_Policy policy);
+// Ticks to run now, `now` in seconds.
+size_t sched_update(Sched *sched, double now);
+// When the next tick is due, in the same clock as sched_update().
+double sched_next(Sched *sched);
+
+#endif // SCHED_H_
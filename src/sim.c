@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "nob.h"
+
+#include "sim.h"
+
+// Set in `middle` while it holds a frame the UI has not acquired yet.
+#define SIM_FRAME_FRESH 4
+
+static World_Rect rect_union(World_Rect a, World_Rect b)
+{
+    if (a.width == 0) return b;
+    if (b.width == 0) return a;
+    int x0 = a.x < b.x ? a.x : b.x;
+    int y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return (World_Rect) { .x = x0, .y = y0, .width = x1 - x0, .height = y1 - y0 };
+}
+
+void sim_init(Sim *sim, World *world)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->world = world;
+    sched_init(&sim->sched, 1.0 / 60.0, SCHED_DEFAULT_CATCH_UP, SCHED_DROP);
+    sim->front = 0;
+    sim->middle = 1;
+    sim->back = 2;
+}
+
+void sim_free(Sim *sim)
+{
+    if (sim->threaded) sim_stop(sim);
+    for (size_t i = 0; i < 3; ++i) free(sim->frames[i].pixels);
+    free(sim->rects);
+}
+
+bool sim_push_brush(Sim *sim, Brush_Event event)
+{
+    size_t head = sim->queue_head;
+    if (head - __atomic_load_n(&sim->queue_tail, __ATOMIC_ACQUIRE) == SIM_QUEUE_SIZE) return false;
+    sim->queue[head % SIM_QUEUE_SIZE] = event;
+    __atomic_store_n(&sim->queue_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void sim_step(Sim *sim)
+{
+    World *world = sim->world;
+    world_step(world);
+    world->stats.skipped_ticks = sim->sched.skipped;
+    world->stats.merged_ticks = sim->sched.merged;
+
+    size_t head = __atomic_load_n(&sim->queue_head, __ATOMIC_ACQUIRE);
+    for (size_t tail = sim->queue_tail; tail != head; ++tail) {
+        Brush_Event event = sim->queue[tail % SIM_QUEUE_SIZE];
+        if (sim->replaying) continue;
+        event.tick = world->tick;
+        recording_apply(world, event);
+        if (sim->recording_input) nob_da_append(sim->recording, event);
+    }
+    __atomic_store_n(&sim->queue_tail, head, __ATOMIC_RELEASE);
+
+    if (sim->replaying) {
+        recording_play(sim->recording, &sim->replay_cursor, world);
+        if (world->tick >= sim->recording->ticks) {
+            nob_log(NOB_INFO, "replay finished at tick %zu, checksum %016" PRIx64, world->tick, world_checksum(world));
+            sim->replaying = false;
+        }
+    }
+}
+
+static void sim_publish(Sim *sim)
+{
+    World *world = sim->world;
+
+    World_Rect changed = {0};
+    size_t count = world_take_changed_rects(world, sim->rects);
+    for (size_t i = 0; i < count; ++i) changed = rect_union(changed, sim->rects[i]);
+    for (size_t i = 0; i < 3; ++i) sim->frames[i].pending = rect_union(sim->frames[i].pending, changed);
+
+    Sim_Frame *back = &sim->frames[sim->back];
+    World_Rect pending = back->pending;
+    for (int y = pending.y; y < pending.y + pending.height; ++y) {
+        World_Rect row = { .x = pending.x, .y = y, .width = pending.width, .height = 1 };
+        world_copy_colors(world, row, &back->pixels[world_get_index(world, pending.x, y)]);
+    }
+    back->pending = (World_Rect) {0};
+    back->stats = world->stats;
+
+    // The UI only uploads the frames it acquires, so the changes of a frame
+    // it skipped have to come along with the next one. If the UI grabs it
+    // right after this check, they just get uploaded twice.
+    back->upload = changed;
+    uint8_t middle = __atomic_load_n(&sim->middle, __ATOMIC_ACQUIRE);
+    if (middle & SIM_FRAME_FRESH) {
+        back->upload = rect_union(back->upload, sim->frames[middle & 3].upload);
+    }
+
+    uint8_t previous = __atomic_exchange_n(&sim->middle, sim->back | SIM_FRAME_FRESH, __ATOMIC_ACQ_REL);
+    sim->back = previous & 3;
+}
+
+static double sim_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *sim_thread(void *arg)
+{
+    Sim *sim = arg;
+    while (__atomic_load_n(&sim->running, __ATOMIC_ACQUIRE)) {
+        size_t due = sched_update(&sim->sched, sim_now());
+        for (size_t i = 0; i < due; ++i) sim_step(sim);
+        if (due > 0) sim_publish(sim);
+
+        double next = sched_next(&sim->sched);
+        struct timespec ts = { .tv_sec = (time_t)next, .tv_nsec = (next - (time_t)next) * 1e9 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {}
+    }
+    return NULL;
+}
+
+void sim_start(Sim *sim)
+{
+    World *world = sim->world;
+    World_Rect all = { .x = 0, .y = 0, .width = world->width, .height = world->height };
+    for (size_t i = 0; i < 3; ++i) {
+        sim->frames[i].pixels = calloc(world->width * world->height, sizeof(Color));
+        assert(sim->frames[i].pixels && "Could not allocate sim frames");
+        sim->frames[i].pending = all;
+    }
+    sim->rects = malloc(sizeof(World_Rect) * world->chunks_width * world->chunks_height);
+    assert(sim->rects && "Could not allocate sim rects");
+
+    // The first frame carries the whole world, whatever the UI drew before.
+    sim_publish(sim);
+    sim->frames[sim->middle & 3].upload = all;
+
+    sim->threaded = true;
+    sim->running = true;
+    int result = pthread_create(&sim->thread, NULL, sim_thread, sim);
+    assert(result == 0 && "Could not start sim thread");
+    (void)result;
+}
+
+void sim_stop(Sim *sim)
+{
+    if (!sim->threaded) return;
+    __atomic_store_n(&sim->running, false, __ATOMIC_RELEASE);
+    pthread_join(sim->thread, NULL);
+    sim->threaded = false;
+}
+
+const Sim_Frame *sim_acquire(Sim *sim, bool *fresh)
+{
+    *fresh = __atomic_load_n(&sim->middle, __ATOMIC_ACQUIRE) & SIM_FRAME_FRESH;
+    if (*fresh) {
+        uint8_t previous = __atomic_exchange_n(&sim->middle, sim->front, __ATOMIC_ACQ_REL);
+        sim->front = previous & 3;
+    }
+    return &sim->frames[sim->front];
+}
@@ -0,0 +1,82 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "world.h"
+#include "recording.h"
+#include "sched.h"
+
+// Drives a world: steps it, applies brush events queued by the UI, and makes
+// or plays back a recording of them.
+//
+// sim_step() can be called from the UI thread directly. Once sim_start() is
+// called the simulation runs on its own thread at a fixed rate instead, and
+// the UI must only talk to it through sim_push_brush() and sim_acquire(): the
+// thread publishes the colours of the world into a triple buffer after every
+// tick, so neither side ever waits for the other.
+
+#define SIM_QUEUE_SIZE 256
+
+typedef struct Sim_Frame {
+    // Colours of the whole world, width*height.
+    Color *pixels;
+    // What changed since the frame published before this one, or before the
+    // last one the UI acquired if it skipped some. Empty if width is 0.
+    World_Rect upload;
+    // What changed in the world since these pixels were last written.
+    World_Rect pending;
+    World_Stats stats;
+} Sim_Frame;
+
+typedef struct Sim {
+    World *world;
+
+    // Brush events from the UI, single producer single consumer. The sim
+    // stamps them with the tick they get applied at.
+    Brush_Event queue[SIM_QUEUE_SIZE];
+    size_t queue_head;
+    size_t queue_tail;
+
+    // Recording that applied events are appended to when `recording_input`
+    // is set, or that is played back while `replaying` is set.
+    Recording *recording;
+    bool recording_input;
+    bool replaying;
+    size_t replay_cursor;
+
+    // Decides how many ticks to run, both for sim_update() and the thread.
+    Sched sched;
+
+    pthread_t thread;
+    bool threaded;
+    bool running;
+
+    // Triple buffer: the sim writes `back` and swaps it with `middle`, the UI
+    // swaps `front` with `middle` when it holds a frame it has not seen yet.
+    Sim_Frame frames[3];
+    uint8_t back;
+    uint8_t middle;
+    uint8_t front;
+    World_Rect *rects;
+} Sim;
+
+void sim_init(Sim *sim, World *world);
+void sim_free(Sim *sim);
+
+// Queue a brush event for the next tick, false if the queue is full.
+bool sim_push_brush(Sim *sim, Brush_Event event);
+// One tick of the world followed by the brush events queued for it.
+void sim_step(Sim *sim);
+
+// Run the thread at the rate and with the overload policy of `sim->sched`.
+void sim_start(Sim *sim);
+void sim_stop(Sim *sim);
+// Latest frame published by the sim thread. `fresh` tells whether it is a
+// new one since the last call, its `upload` rect is only meaningful if so.
+const Sim_Frame *sim_acquire(Sim *sim, bool *fresh);
+
+#endif // SIM_H_
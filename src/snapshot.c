@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nob.h"
+
+#include "snapshot.h"
+
+// Planes of raw snapshots start on a page boundary, so a written page of a
+// mapped world never shares its copy with another plane or the header.
+#define SNAPSHOT_ALIGN 4096
+#define SNAPSHOT_ALIGN_UP(n) (((n) + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1))
+
+static void sb_pad_to(Nob_String_Builder *sb, size_t offset)
+{
+    while (sb->count < offset) nob_da_append(sb, 0);
+}
+
+static void sb_append_leb128(Nob_String_Builder *sb, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        nob_da_append(sb, byte);
+    } while (value);
+}
+
+static bool read_leb128(const uint8_t **it, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *it < end; shift += 7) {
+        uint8_t byte = *(*it)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static void snapshot_encode_rle(World *world, Nob_String_Builder *sb, Snapshot_Header *header)
+{
+    size_t cells = world->width * world->height;
+
+    header->types_offset = sb->count;
+    for (size_t i = 0; i < cells;) {
+        uint8_t type = world->types[i];
+        size_t run = 1;
+        while (i + run < cells && world->types[i + run] == type) run += 1;
+        nob_da_append(sb, type);
+        sb_append_leb128(sb, run);
+        i += run;
+    }
+    header->types_size = sb->count - header->types_offset;
+
+    header->shades_offset = sb->count;
+    bool high = false;
+    for (size_t i = 0; i < cells; ++i) {
+        if (world->types[i] == PT_EMPTY) continue;
+        uint8_t shade = world->shades[i] & 0x0f;
+        if (high) sb->items[sb->count - 1] |= shade << 4;
+        else nob_da_append(sb, shade);
+        high = !high;
+    }
+    header->shades_size = sb->count - header->shades_offset;
+}
+
+static void snapshot_encode_raw(World *world, Nob_String_Builder *sb, Snapshot_Header *header)
+{
+    size_t cells = world->width * world->height;
+
+    sb_pad_to(sb, SNAPSHOT_ALIGN_UP(sb->count));
+    header->types_offset = sb->count;
+    header->types_size = cells;
+    nob_sb_append_buf(sb, world->types, cells);
+
+    sb_pad_to(sb, SNAPSHOT_ALIGN_UP(sb->count));
+    header->shades_offset = sb->count;
+    header->shades_size = cells;
+    nob_sb_append_buf(sb, world->shades, cells);
+}
+
+bool world_save(World *world, const char *path, Snapshot_Encoding encoding)
+{
+    Snapshot_Header header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .encoding = encoding,
+        .width = world->width,
+        .height = world->height,
+        .seed = world->seed,
+        .tick = world->tick,
+    };
+
+    Nob_String_Builder sb = {0};
+    sb_pad_to(&sb, sizeof(header));
+    switch (encoding) {
+    case SNAPSHOT_RLE: snapshot_encode_rle(world, &sb, &header); break;
+    case SNAPSHOT_RAW: snapshot_encode_raw(world, &sb, &header); break;
+    default:
+        nob_log(NOB_ERROR, "unknown snapshot encoding %d", encoding);
+        nob_sb_free(sb);
+        return false;
+    }
+    memcpy(sb.items, &header, sizeof(header));
+
+    bool result = nob_write_entire_file(path, sb.items, sb.count);
+    nob_sb_free(sb);
+    return result;
+}
+
+static bool snapshot_decode_rle(World *world, const uint8_t *data, const Snapshot_Header *header)
+{
+    size_t cells = world->width * world->height;
+
+    const uint8_t *it = data + header->types_offset;
+    const uint8_t *end = it + header->types_size;
+    size_t filled = 0;
+    while (filled < cells) {
+        if (it >= end) return false;
+        uint8_t type = *it++;
+        uint64_t run;
+        if (type >= PT_COUNT || !read_leb128(&it, end, &run)) return false;
+        if (run == 0 || run > cells - filled) return false;
+        memset(&world->types[filled], type, run);
+        filled += run;
+    }
+
+    const uint8_t *shades = data + header->shades_offset;
+    size_t particle = 0;
+    for (size_t i = 0; i < cells; ++i) {
+        if (world->types[i] == PT_EMPTY) continue;
+        if (particle / 2 >= header->shades_size) return false;
+        world->shades[i] = (shades[particle / 2] >> (particle % 2 * 4)) & 0x0f;
+        particle += 1;
+    }
+    return true;
+}
+
+// Points the world at the planes inside the mapping, which it takes over.
+static bool snapshot_adopt_raw(World *world, uint8_t *data, size_t size, const Snapshot_Header *header)
+{
+    size_t cells = world->width * world->height;
+    if (header->types_size != cells || header->shades_size != cells) return false;
+
+    uint8_t *types = data + header->types_offset;
+    uint8_t *shades = data + header->shades_offset;
+    uint8_t invalid = 0;
+    for (size_t i = 0; i < cells; ++i) {
+        invalid |= types[i] >= PT_COUNT;
+        invalid |= shades[i] >= PALETTE_SHADES;
+    }
+    if (invalid) return false;
+
+    // The planes world_new() made are left in its arena untouched, never
+    // written to they take up no memory.
+    world->types = types;
+    world->shades = shades;
+    world->mapping = data;
+    world->mapping_size = size;
+    return true;
+}
+
+static bool snapshot_range_valid(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+    return offset <= file_size && size <= file_size - offset;
+}
+
+World *world_load(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        nob_log(NOB_ERROR, "could not open snapshot %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        nob_log(NOB_ERROR, "could not stat snapshot %s: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(Snapshot_Header)) {
+        nob_log(NOB_ERROR, "%s is not a snapshot", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Private and writable, raw worlds keep running on top of the mapping.
+    uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        nob_log(NOB_ERROR, "could not map snapshot %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    Snapshot_Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+        nob_log(NOB_ERROR, "%s is not a version %d snapshot", path, SNAPSHOT_VERSION);
+        munmap(data, size);
+        return NULL;
+    }
+    // Both are 32 bit, the product can not overflow 64 bits.
+    uint64_t cells = (uint64_t)header.width * header.height;
+    if (header.width == 0 || header.height == 0 || cells > SNAPSHOT_MAX_CELLS || cells > SIZE_MAX / 8
+        || !snapshot_range_valid(header.types_offset, header.types_size, size)
+        || !snapshot_range_valid(header.shades_offset, header.shades_size, size)
+        || (header.encoding == SNAPSHOT_RAW && (header.types_size != cells || header.shades_size != cells))) {
+        nob_log(NOB_ERROR, "snapshot %s is truncated or corrupt", path);
+        munmap(data, size);
+        return NULL;
+    }
+
+    World *world = world_new(header.width, header.height);
+    bool ok = false;
+    switch (header.encoding) {
+    case SNAPSHOT_RLE:
+        ok = snapshot_decode_rle(world, data, &header);
+        munmap(data, size);
+        break;
+    case SNAPSHOT_RAW:
+        ok = snapshot_adopt_raw(world, data, size, &header);
+        if (!ok) munmap(data, size);
+        break;
+    default:
+        munmap(data, size);
+        break;
+    }
+    if (!ok) {
+        nob_log(NOB_ERROR, "snapshot %s is truncated or corrupt", path);
+        world_free(world);
+        return NULL;
+    }
+
+    world_set_seed(world, header.seed);
+    world->tick = header.tick;
+    world->stats.ticks = header.tick;
+    world_refresh(world);
+    return world;
+}
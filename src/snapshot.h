@@ -0,0 +1,56 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "world.h"
+
+// A snapshot stores the particle grid of a world: one type byte and one shade
+// per cell, plus the seed and tick so a run can be picked up where it was
+// saved. Flags and velocities are not stored, particles start at rest.
+//
+// The file is a Snapshot_Header followed by a types plane and a shades plane,
+// in host byte order.
+//
+// SNAPSHOT_RLE encodes the types plane as runs of (type byte, LEB128 length)
+// and stores the shades of non-empty cells only, two per byte. Small on disk,
+// loading decodes it into a freshly allocated world.
+//
+// SNAPSHOT_RAW stores both planes verbatim at page aligned offsets, so
+// world_load() maps the file privately and uses the planes in place. Pages
+// are only read when touched and only copied when written to.
+#define SNAPSHOT_MAGIC   "FSND"
+#define SNAPSHOT_VERSION 1
+
+// Largest world a snapshot may ask for, checked before anything is allocated
+// for it. Far more than fits in memory, streamed worlds included.
+#define SNAPSHOT_MAX_CELLS (1ull << 36)
+
+typedef enum Snapshot_Encoding {
+    SNAPSHOT_RLE = 0,
+    SNAPSHOT_RAW,
+} Snapshot_Encoding;
+
+typedef struct Snapshot_Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t encoding;  // Snapshot_Encoding
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+    uint64_t seed;
+    uint64_t tick;
+    // Byte ranges of the planes, from the start of the file.
+    uint64_t types_offset;
+    uint64_t types_size;
+    uint64_t shades_offset;
+    uint64_t shades_size;
+} Snapshot_Header;
+
+bool world_save(World *world, const char *path, Snapshot_Encoding encoding);
+// Returns NULL and logs why if the file can not be read or is not a valid
+// snapshot. The world comes back single threaded with the saved seed.
+World *world_load(const char *path);
+
+#endif // SNAPSHOT_H_
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nob.h"
+
+#include "stream.h"
+#include "snapshot.h"
+
+// Where the Stream_Header goes in the header page.
+#define STREAM_HEADER_OFFSET 128
+static_assert(sizeof(Snapshot_Header) <= STREAM_HEADER_OFFSET, "snapshot header overlaps the stream header");
+static_assert(STREAM_HEADER_OFFSET + sizeof(Stream_Header) <= STREAM_HEADER_SIZE, "stream header does not fit its page");
+
+static Snapshot_Header *stream_snapshot_header(Stream *stream)
+{
+    return (Snapshot_Header *)stream->mapping;
+}
+
+static Stream_Header *stream_header(Stream *stream)
+{
+    return (Stream_Header *)(stream->mapping + STREAM_HEADER_OFFSET);
+}
+
+// Hand the whole pages within [begin, end) back to the kernel.
+static void stream_release(void *begin, void *end)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t from = ((uintptr_t)begin + page - 1) & ~(page - 1);
+    uintptr_t to = (uintptr_t)end & ~(page - 1);
+    if (from >= to) return;
+
+#ifdef MADV_PAGEOUT
+    // Write back and free what can be, this skips large folios that reach
+    // past the range.
+    madvise((void *)from, to - from, MADV_PAGEOUT);
+#endif
+    // Whatever is left drops out of the mapping and stays in the page cache,
+    // written back by the kernel in its own time. Touching it again reads it
+    // back from there or from the file.
+    madvise((void *)from, to - from, MADV_DONTNEED);
+}
+
+static void stream_page_out(Stream *stream, size_t band)
+{
+    World *world = stream->world;
+    size_t y0 = band * STREAM_BAND_ROWS;
+    size_t y1 = y0 + STREAM_BAND_ROWS < world->height ? y0 + STREAM_BAND_ROWS : world->height;
+
+    uint8_t *planes[] = { world->types, world->shades, world->flags, (uint8_t *)world->velocity };
+    for (size_t i = 0; i < NOB_ARRAY_LEN(planes); ++i) {
+        stream_release(planes[i] + y0 * world->width, planes[i] + y1 * world->width);
+    }
+    stream_release(world->occupied + y0 * world->row_words, world->occupied + y1 * world->row_words);
+    stream_release(world->fluids + y0 * world->row_words, world->fluids + y1 * world->row_words);
+    stream_release(world->columns + y0 / 64 * world->width, world->columns + (y1 + 63) / 64 * world->width);
+    stream_release(world->chunks + y0 / CHUNK_SIZE * world->chunks_width,
+                   world->chunks + (y1 + CHUNK_SIZE - 1) / CHUNK_SIZE * world->chunks_width);
+
+    stream->band_used[band] = 0;
+    stream->resident -= 1;
+    stream->paged_out += 1;
+}
+
+static bool stream_check_headers(Stream *stream, const char *path)
+{
+    Snapshot_Header *snapshot = stream_snapshot_header(stream);
+    Stream_Header *header = stream_header(stream);
+    if (stream->mapping_size < STREAM_HEADER_SIZE
+        || memcmp(snapshot->magic, SNAPSHOT_MAGIC, sizeof(snapshot->magic)) != 0
+        || snapshot->version != SNAPSHOT_VERSION
+        || snapshot->encoding != SNAPSHOT_RAW
+        || memcmp(header->magic, STREAM_MAGIC, sizeof(header->magic)) != 0
+        || header->version != STREAM_VERSION) {
+        nob_log(NOB_ERROR, "%s is not a version %d streamed world", path, STREAM_VERSION);
+        return false;
+    }
+    uint64_t cells = (uint64_t)snapshot->width * snapshot->height;
+    if (snapshot->width == 0 || snapshot->height == 0 || cells > SNAPSHOT_MAX_CELLS
+        || snapshot->types_size != cells || snapshot->shades_size != cells
+        || stream->mapping_size != STREAM_HEADER_SIZE + world_storage_size(snapshot->width, snapshot->height)) {
+        nob_log(NOB_ERROR, "streamed world %s is truncated or corrupt", path);
+        return false;
+    }
+    return true;
+}
+
+// The planes have to be where the world keeps them and hold nothing a tick
+// could index a table out of bounds with. Every page is read for it, a band
+// at a time, and handed back right away.
+static bool stream_check_planes(Stream *stream, World *world, const char *path)
+{
+    Snapshot_Header *snapshot = stream_snapshot_header(stream);
+    if (world->types != stream->mapping + snapshot->types_offset
+        || world->shades != stream->mapping + snapshot->shades_offset) {
+        nob_log(NOB_ERROR, "streamed world %s is truncated or corrupt", path);
+        return false;
+    }
+
+    size_t band_cells = STREAM_BAND_ROWS * world->width;
+    size_t cells = world->width * world->height;
+    uint8_t invalid = 0;
+    for (size_t begin = 0; begin < cells && !invalid; begin += band_cells) {
+        size_t end = begin + band_cells < cells ? begin + band_cells : cells;
+        for (size_t i = begin; i < end; ++i) {
+            invalid |= world->types[i] >= PT_COUNT;
+            invalid |= world->shades[i] >= PALETTE_SHADES;
+        }
+        stream_release(world->types + begin, world->types + end);
+        stream_release(world->shades + begin, world->shades + end);
+    }
+    if (invalid) {
+        nob_log(NOB_ERROR, "streamed world %s holds invalid particles", path);
+        return false;
+    }
+    return true;
+}
+
+World *stream_open(Stream *stream, const char *path, size_t width, size_t height, size_t budget)
+{
+    *stream = (Stream) {
+        .fd = -1,
+        .budget = budget,
+    };
+
+    stream->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (stream->fd < 0) {
+        nob_log(NOB_ERROR, "could not open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(stream->fd, &st) < 0) {
+        nob_log(NOB_ERROR, "could not stat %s: %s", path, strerror(errno));
+        stream_close(stream);
+        return NULL;
+    }
+    bool existing = st.st_size > 0;
+    if (existing) {
+        stream->mapping_size = st.st_size;
+    } else {
+        // Never written, so the file is a hole and reads back as zeroes.
+        stream->mapping_size = STREAM_HEADER_SIZE + world_storage_size(width, height);
+        if (ftruncate(stream->fd, stream->mapping_size) < 0) {
+            nob_log(NOB_ERROR, "could not size %s: %s", path, strerror(errno));
+            stream_close(stream);
+            return NULL;
+        }
+    }
+
+    stream->mapping = mmap(NULL, stream->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, stream->fd, 0);
+    if (stream->mapping == MAP_FAILED) {
+        nob_log(NOB_ERROR, "could not map %s: %s", path, strerror(errno));
+        stream->mapping = NULL;
+        stream_close(stream);
+        return NULL;
+    }
+
+    Snapshot_Header *snapshot = stream_snapshot_header(stream);
+    Stream_Header *header = stream_header(stream);
+    if (existing) {
+        if (!stream_check_headers(stream, path)) {
+            stream_close(stream);
+            return NULL;
+        }
+        width = snapshot->width;
+        height = snapshot->height;
+    }
+
+    World *world = world_new_in(width, height, stream->mapping + STREAM_HEADER_SIZE, existing);
+    if (existing && !stream_check_planes(stream, world, path)) {
+        // Not handed to the stream yet, closing it leaves the file as it was.
+        world_free(world);
+        stream_close(stream);
+        return NULL;
+    }
+    stream->world = world;
+    if (existing) {
+        world_set_seed(world, snapshot->seed);
+        world->tick = snapshot->tick;
+        if (header->clean) {
+            world->stats = header->stats;
+        } else {
+            nob_log(NOB_WARNING, "%s was not closed, rebuilding it from its particles", path);
+            world_refresh(world);
+        }
+        world->stats.ticks = world->tick;
+    } else {
+        *snapshot = (Snapshot_Header) {
+            .magic = SNAPSHOT_MAGIC,
+            .version = SNAPSHOT_VERSION,
+            .encoding = SNAPSHOT_RAW,
+            .width = width,
+            .height = height,
+            .types_offset = world->types - stream->mapping,
+            .types_size = width * height,
+            .shades_offset = world->shades - stream->mapping,
+            .shades_size = width * height,
+        };
+        *header = (Stream_Header) {
+            .magic = STREAM_MAGIC,
+            .version = STREAM_VERSION,
+        };
+    }
+    header->clean = false;
+    msync(stream->mapping, STREAM_HEADER_SIZE, MS_SYNC);
+
+    stream->bands = (height + STREAM_BAND_ROWS - 1) / STREAM_BAND_ROWS;
+    stream->band_size = STREAM_BAND_ROWS * (4 * width + 2 * world->row_words * sizeof(uint64_t))
+        + STREAM_BAND_ROWS / 64 * width * sizeof(uint64_t)
+        + STREAM_BAND_ROWS / CHUNK_SIZE * world->chunks_width * sizeof(Chunk);
+    stream->band_used = calloc(stream->bands, sizeof(*stream->band_used));
+    assert(stream->band_used && "Could not allocate stream bands");
+
+    // A new world wrote every chunk to set it up, start out with none of it
+    // resident.
+    if (!existing) {
+        stream->resident = stream->bands;
+        for (size_t band = 0; band < stream->bands; ++band) stream_page_out(stream, band);
+        stream->paged_out = 0;
+    }
+
+    return world;
+}
+
+void stream_update(Stream *stream)
+{
+    World *world = stream->world;
+    stream->updates += 1;
+
+    // A band either side of the region as well, moves near its edges reach
+    // into the chunks around it.
+    size_t first = world->region.min_y * CHUNK_SIZE / STREAM_BAND_ROWS;
+    size_t last = (world->region.max_y * CHUNK_SIZE + STREAM_BAND_ROWS - 1) / STREAM_BAND_ROWS;
+    if (first > 0) first -= 1;
+    if (last < stream->bands) last += 1;
+    if (world->region.min_x == world->region.max_x) last = first;
+    for (size_t band = first; band < last; ++band) {
+        if (stream->band_used[band] == 0) stream->resident += 1;
+        stream->band_used[band] = stream->updates;
+    }
+
+    size_t keep = stream->budget / stream->band_size;
+    while (stream->resident > keep) {
+        size_t oldest = stream->bands;
+        for (size_t band = 0; band < stream->bands; ++band) {
+            uint64_t used = stream->band_used[band];
+            if (used == 0 || used == stream->updates) continue;
+            if (oldest == stream->bands || used < stream->band_used[oldest]) oldest = band;
+        }
+        // Whatever is left is needed right now, the budget is too small
+        // for the region.
+        if (oldest == stream->bands) break;
+        stream_page_out(stream, oldest);
+    }
+}
+
+bool stream_close(Stream *stream)
+{
+    bool result = true;
+    if (stream->world) {
+        Snapshot_Header *snapshot = stream_snapshot_header(stream);
+        Stream_Header *header = stream_header(stream);
+        snapshot->seed = stream->world->seed;
+        snapshot->tick = stream->world->tick;
+        header->stats = stream->world->stats;
+        // Everything else first, so the file is only marked clean once it is.
+        result = msync(stream->mapping, stream->mapping_size, MS_SYNC) == 0;
+        header->clean = result;
+        result = result && msync(stream->mapping, STREAM_HEADER_SIZE, MS_SYNC) == 0;
+        if (!result) nob_log(NOB_ERROR, "could not write the streamed world back: %s", strerror(errno));
+        world_free(stream->world);
+    }
+    if (stream->mapping) munmap(stream->mapping, stream->mapping_size);
+    if (stream->fd >= 0) close(stream->fd);
+    free(stream->band_used);
+    *stream = (Stream) { .fd = -1 };
+    return result;
+}
@@ -0,0 +1,78 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "world.h"
+
+// A world kept in a file instead of in memory, for worlds far bigger than
+// memory. Only the part of it around the region being simulated (see
+// world_set_region()) has to be resident, the rest waits on disk.
+//
+// The file is a raw snapshot (see snapshot.h) whose planes are those of the
+// world's own storage: a header page, then everything world_storage_size()
+// covers, mapped shared. Pages are read in when a tick or the renderer first
+// touches them and written back by the kernel, and world_load() or
+// `bench -load` open the same file as any other snapshot. Nothing is
+// compressed, paging a band out is only a matter of letting the kernel drop
+// its pages: the file takes a little over 4 bytes per cell of every band
+// written so far, while bands never written stay holes.
+//
+// The grid is handed back to the kernel in bands of STREAM_BAND_ROWS rows,
+// every plane, bitmap and chunk of those rows at once. Bands are counted as
+// resident from the first time they come near the region, and once there are
+// more of them than fit the budget the ones left unused for longest are
+// paged out, written to the file first if dirty.
+#define STREAM_BAND_ROWS 64
+static_assert(STREAM_BAND_ROWS % 64 == 0 && STREAM_BAND_ROWS % CHUNK_SIZE == 0, "bands must cover whole bitmap words and chunks");
+
+#define STREAM_MAGIC   "FSTR"
+#define STREAM_VERSION 1
+
+// Bytes before the storage of the world, the first page of the file.
+#define STREAM_HEADER_SIZE 4096
+
+// Follows the Snapshot_Header in the header page, what world_load() does not
+// need to know to pick the world up again.
+typedef struct Stream_Header {
+    char magic[4];
+    uint32_t version;
+    // Unset while the file is open, a world that was not closed has to have
+    // its stats, bitmaps and chunks rebuilt from the particles.
+    uint32_t clean;
+    uint32_t reserved;
+    World_Stats stats;
+} Stream_Header;
+
+typedef struct Stream {
+    World *world;
+    int fd;
+    uint8_t *mapping;
+    size_t mapping_size;
+
+    size_t budget;      // bytes of bands kept resident at most
+    size_t band_size;   // bytes of one band, across everything in it
+    size_t bands;
+    // Number of the stream_update() that last needed a band, 0 once it has
+    // been paged out.
+    uint64_t *band_used;
+    uint64_t updates;
+    size_t resident;    // bands not paged out since they were last needed
+    size_t paged_out;   // bands paged out so far
+} Stream;
+
+// Open the world streamed from `path`, or create an empty one of
+// `width` x `height` cells there if the file does not exist yet, in which
+// case it takes no room on disk until written to. An existing file keeps its
+// own size. Returns NULL and logs why on failure.
+World *stream_open(Stream *stream, const char *path, size_t width, size_t height, size_t budget);
+// Call after moving the region, before the next tick. Marks the bands in and
+// around the region as needed and pages out others until the budget holds.
+void stream_update(Stream *stream);
+// Write the seed, tick and stats of the world into the file and free the
+// world along with everything else.
+bool stream_close(Stream *stream);
+
+#endif // STREAM_H_
@@ -0,0 +1,1263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sys/mman.h>
+
+#include "nob.h"
+
+// Has to come before anything pulls in arena.h.
+#define ARENA_BACKEND ARENA_BACKEND_LINUX_MMAP
+#include "world.h"
+#include "prof.h"
+#include "colors.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+// Same as raylib's ColorBrightness(), kept here so the simulation does not
+// have to link against raylib.
+static Color color_brightness(Color color, float factor)
+{
+    factor = CLAMP(factor, -1.0f, 1.0f);
+
+    float red = color.r;
+    float green = color.g;
+    float blue = color.b;
+
+    if (factor < 0.0f) {
+        factor = 1.0f + factor;
+        red *= factor;
+        green *= factor;
+        blue *= factor;
+    } else {
+        red = (255 - red)*factor + red;
+        green = (255 - green)*factor + green;
+        blue = (255 - blue)*factor + blue;
+    }
+
+    return (Color){
+        .r = (unsigned char)red,
+        .g = (unsigned char)green,
+        .b = (unsigned char)blue,
+        .a = color.a,
+    };
+}
+
+// Every kernel runs the same rules in the same order, each instantiation only
+// switches a different subset of them on. `rules` is a constant in all of
+// them, so the rules a material does not have are compiled out.
+static inline __attribute__((always_inline)) void material_update(World_Worker *w, size_t x, size_t y, const Particle_Properties rules)
+{
+    if (rules & (PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE)) {
+        // Set before moving, the in-place engine takes the flags along with it.
+        uint8_t *flags = &w->world->flags[world_get_index(w->world, x, y)];
+        bool free_falling = *flags & PF_FREE_FALLING;
+        *flags |= PF_FREE_FALLING;
+        if ((rules & PP_MOVE_DOWN) && world_move_down(w, x, y, free_falling)) return;
+    }
+    if ((rules & PP_MOVE_DOWN_SIDE) && world_move_down_side(w, x, y)) return;
+    if ((rules & PP_MOVE_UP) && world_move_up(w, x, y)) return;
+    if ((rules & PP_MOVE_UP_SIDE) && world_move_up_side(w, x, y)) return;
+    if ((rules & PP_MOVE_SIDE) && world_move_side(w, x, y)) return;
+}
+
+#define MATERIAL_KERNEL(name, rules) \
+    static void name(World_Worker *w, size_t x, size_t y) { material_update(w, x, y, (rules)); }
+
+MATERIAL_KERNEL(material_update_powder, PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE)
+MATERIAL_KERNEL(material_update_liquid, PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE | PP_MOVE_SIDE)
+MATERIAL_KERNEL(material_update_gas, PP_MOVE_UP | PP_MOVE_UP_SIDE | PP_MOVE_SIDE)
+
+const Material_Info MATERIALS[PT_COUNT] = {
+    [PT_EMPTY] = {
+        .name = "Empty",
+        .props = PP_NONE,
+        .color = BLANK,
+        .chance = 1,
+    },
+    [PT_SAND] = {
+        .name = "Sand",
+        .props = PP_SOLID | PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE,
+        .density = 16,
+        .color = {.r=235,.g=200,.b=175,.a=255},
+        .chance = 10,
+        .update = material_update_powder,
+    },
+    [PT_WATER] = {
+        .name = "Water",
+        .props = PP_LIQUID | PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE | PP_MOVE_SIDE,
+        .density = 10,
+        .spread_factor = 5,
+        .color = {.r=175,.g=200,.b=235,.a=255},
+        .chance = 10,
+        .update = material_update_liquid,
+    },
+    [PT_STONE] = {
+        .name = "Stone",
+        .props = PP_SOLID,
+        .density = 100,
+        .color = GRAY,
+        .chance = 1,
+    },
+    [PT_OIL] = {
+        .name = "Oil",
+        .props = PP_LIQUID | PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE | PP_MOVE_SIDE,
+        .density = 8,
+        .spread_factor = 3,
+        .color = {.r=90,.g=65,.b=40,.a=255},
+        .chance = 10,
+        .update = material_update_liquid,
+    },
+    [PT_GAS] = {
+        .name = "Gas",
+        .props = PP_GAS | PP_MOVE_UP | PP_MOVE_UP_SIDE | PP_MOVE_SIDE,
+        .density = 1,
+        .spread_factor = 8,
+        .color = {.r=190,.g=210,.b=170,.a=255},
+        .chance = 20,
+        .update = material_update_gas,
+    },
+    [PT_LAVA] = {
+        .name = "Lava",
+        .props = PP_LIQUID | PP_MOVE_DOWN | PP_MOVE_DOWN_SIDE | PP_MOVE_SIDE,
+        .density = 14,
+        .spread_factor = 1,
+        .color = {.r=230,.g=90,.b=20,.a=255},
+        .chance = 10,
+        .update = material_update_liquid,
+    },
+    [PT_WOOD] = {
+        .name = "Wood",
+        .props = PP_SOLID,
+        .density = 100,
+        .color = {.r=120,.g=80,.b=45,.a=255},
+        .chance = 1,
+    },
+};
+
+Color PARTICLE_PALETTE[PT_COUNT][PALETTE_SHADES];
+
+static pthread_once_t particle_palette_once = PTHREAD_ONCE_INIT;
+
+// Shades spread the brightness evenly over [-1/4, 1/4], the range particles
+// used to pick from at random when they stored their own colour.
+static void particle_palette_init(void)
+{
+    for (size_t type = 0; type < PT_COUNT; ++type) {
+        for (size_t shade = 0; shade < PALETTE_SHADES; ++shade) {
+            float factor = ((((float)shade + 0.5f) / PALETTE_SHADES)*2 - 1)/4;
+            PARTICLE_PALETTE[type][shade] = type == PT_EMPTY
+                ? BLANK
+                : color_brightness(MATERIALS[type].color, factor);
+        }
+    }
+}
+
+int particle_chance(Particle_Type type) {
+    return MATERIALS[type].chance;
+}
+
+// Size of an arena allocation of `count` items of `size` bytes, in the words
+// regions are counted in.
+static size_t world_arena_words(size_t count, size_t size)
+{
+    return (count * size + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+}
+
+#define WORLD_PAGE_SIZE 4096
+#define WORLD_PAGE_UP(n) (((n) + WORLD_PAGE_SIZE - 1) & ~(size_t)(WORLD_PAGE_SIZE - 1))
+
+// Where the grid sized arrays go in the storage of a world, as byte offsets.
+// Each one starts on a page of its own, so a band of rows of any of them
+// covers whole pages that can be handed back on their own, see stream.h.
+typedef struct World_Layout {
+    size_t types, shades, flags, velocity;
+    size_t columns, occupied, fluids;
+    size_t chunks;
+    size_t size;
+} World_Layout;
+
+static World_Layout world_layout(size_t width, size_t height)
+{
+    size_t cells = width * height;
+    size_t column_words = (height + 63) / 64;
+    size_t row_words = (width + 63) / 64;
+    size_t chunks = ((width + CHUNK_SIZE - 1) / CHUNK_SIZE) * ((height + CHUNK_SIZE - 1) / CHUNK_SIZE);
+
+    World_Layout layout = {0};
+    size_t at = 0;
+    layout.types = at;    at = WORLD_PAGE_UP(at + cells);
+    layout.shades = at;   at = WORLD_PAGE_UP(at + cells);
+    layout.flags = at;    at = WORLD_PAGE_UP(at + cells);
+    layout.velocity = at; at = WORLD_PAGE_UP(at + cells);
+    layout.columns = at;  at = WORLD_PAGE_UP(at + width * column_words * sizeof(uint64_t));
+    layout.occupied = at; at = WORLD_PAGE_UP(at + height * row_words * sizeof(uint64_t));
+    layout.fluids = at;   at = WORLD_PAGE_UP(at + height * row_words * sizeof(uint64_t));
+    layout.chunks = at;   at = WORLD_PAGE_UP(at + chunks * sizeof(Chunk));
+    layout.size = at;
+    return layout;
+}
+
+size_t world_storage_size(size_t width, size_t height)
+{
+    return world_layout(width, height).size;
+}
+
+World *world_new(size_t width, size_t height)
+{
+    return world_new_in(width, height, NULL, false);
+}
+
+World *world_new_in(size_t width, size_t height, void *storage, bool reuse)
+{
+    World_Layout layout = world_layout(width, height);
+    size_t cells = width * height;
+    size_t chunks_width = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t chunks_height = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    // Fresh pages are zero, nothing below has to be cleared.
+    Arena arena = {0};
+    arena.begin = arena.end = new_region(
+        world_arena_words(1, sizeof(World))
+        + (storage ? 0 : world_arena_words(layout.size, sizeof(uint8_t))));
+
+    World *world = arena_alloc(&arena, sizeof(World));
+    world->width = width;
+    world->height = height;
+    if (!storage) storage = arena_alloc(&arena, layout.size);
+    assert(arena.end == arena.begin && arena.end->count == arena.end->capacity && "World arena is not sized right");
+    world->arena = arena;
+
+    pthread_once(&particle_palette_once, particle_palette_init);
+
+    uint8_t *base = storage;
+    world->types = base + layout.types;
+    world->shades = base + layout.shades;
+    world->flags = base + layout.flags;
+    world->velocity = (int8_t *)(base + layout.velocity);
+
+    world->column_words = (height + 63) / 64;
+    world->columns = (uint64_t *)(base + layout.columns);
+    world->row_words = (width + 63) / 64;
+    world->occupied = (uint64_t *)(base + layout.occupied);
+    world->fluids = (uint64_t *)(base + layout.fluids);
+    world->sweep_occupied = true;
+
+    world->chunks_width = chunks_width;
+    world->chunks_height = chunks_height;
+    world->chunks = (Chunk *)(base + layout.chunks);
+    for (size_t i = 0; i < chunks_width * chunks_height && !reuse; ++i) {
+        world->chunks[i] = (Chunk) {
+            .next_min_x = INT_MAX,
+            .next_min_y = INT_MAX,
+            .changed_min_x = INT_MAX,
+            .changed_min_y = INT_MAX,
+        };
+    }
+    world_set_region(world, (World_Rect) { 0, 0, (int)width, (int)height });
+
+    world->stats.population[PT_EMPTY] = cells;
+
+    world_set_threads(world, 1);
+    world_set_seed(world, WORLD_DEFAULT_SEED);
+
+    return world;
+}
+
+static void world_free_workers(World *world)
+{
+    for (size_t i = 0; i < world->threads; ++i) {
+        arena_free(&world->workers[i].scratch);
+    }
+    free(world->workers);
+    if (world->pool) pool_free(world->pool);
+}
+
+void world_free(World *world)
+{
+    world_free_workers(world);
+    if (world->mapping) munmap(world->mapping, world->mapping_size);
+    arena_free(&world->scratch);
+    // The World is in its own arena, free a copy.
+    Arena arena = world->arena;
+    arena_free(&arena);
+}
+
+void world_set_threads(World *world, size_t threads)
+{
+    if (threads < 1) threads = 1;
+    if (world->workers) world_free_workers(world);
+
+    world->threads = threads;
+    world->workers = malloc(sizeof(World_Worker) * threads);
+    assert(world->workers && "Could not allocate workers");
+    for (size_t i = 0; i < threads; ++i) {
+        world->workers[i] = (World_Worker) {
+            .world = world,
+        };
+        rng_seed(&world->workers[i].rng, world->seed + i + 1);
+    }
+    world->pool = pool_new(threads);
+}
+
+void world_set_seed(World *world, uint64_t seed)
+{
+    world->seed = seed;
+    rng_seed(&world->rng, seed);
+    for (size_t i = 0; i < world->threads; ++i) {
+        rng_seed(&world->workers[i].rng, seed + i + 1);
+    }
+}
+
+static bool world_is_fluid(Particle_Type type)
+{
+    return MATERIALS[type].props & (PP_LIQUID | PP_GAS);
+}
+
+// Flip the occupancy bits of a cell that went from empty to not or back.
+// Chunks of one phase can both reach into the chunk between them, whose
+// cells share words.
+static void world_occupancy_toggle(World *world, size_t index)
+{
+    size_t x = index % world->width;
+    size_t y = index / world->width;
+    __atomic_fetch_xor(&world->columns[(y / 64) * world->width + x], 1ull << (y % 64), __ATOMIC_RELAXED);
+    __atomic_fetch_xor(&world->occupied[y * world->row_words + x / 64], 1ull << (x % 64), __ATOMIC_RELAXED);
+}
+
+// Keep the bitmaps in step with a cell whose type goes from `old` to `type`.
+static void world_bitmaps_update(World *world, size_t index, Particle_Type old, Particle_Type type)
+{
+    if ((old == PT_EMPTY) != (type == PT_EMPTY)) world_occupancy_toggle(world, index);
+    if (world_is_fluid(old) != world_is_fluid(type)) {
+        size_t x = index % world->width;
+        size_t y = index / world->width;
+        __atomic_fetch_xor(&world->fluids[y * world->row_words + x / 64], 1ull << (x % 64), __ATOMIC_RELAXED);
+    }
+}
+
+// Number of empty cells straight below and including (x, y), counting no
+// further than `limit` cells and stopping at the bottom of the world.
+static size_t world_column_free(World *world, size_t x, size_t y, size_t limit)
+{
+    const uint64_t *column = &world->columns[x];
+    size_t end = y + limit < world->height ? y + limit : world->height;
+    size_t at = y;
+    while (at < end) {
+        uint64_t word = __atomic_load_n(&column[(at / 64) * world->width], __ATOMIC_RELAXED) >> (at % 64);
+        if (word) {
+            at += __builtin_ctzll(word);
+            break;
+        }
+        at = (at / 64 + 1) * 64;
+    }
+    return (at < end ? at : end) - y;
+}
+
+// Offset of the first cell from (x, y) on, going right when `dir` is 1 and
+// left when it is -1, that is empty when `empty` is set and occupied
+// otherwise. Looks at no more than `limit` cells and returns `limit` when
+// none of them matches.
+static size_t world_row_scan(World *world, size_t x, size_t y, size_t limit, int dir, bool empty)
+{
+    const uint64_t *row = &world->occupied[y * world->row_words];
+    size_t offset = 0;
+    while (offset < limit) {
+        size_t at = dir > 0 ? x + offset : x - offset;
+        uint64_t word = __atomic_load_n(&row[at / 64], __ATOMIC_RELAXED);
+        if (empty) word = ~word;
+        // Shift the cells still ahead out of the word, nearest first.
+        size_t left_in_word = dir > 0 ? 64 - at % 64 : at % 64 + 1;
+        word = dir > 0 ? word >> (at % 64) : word << (63 - at % 64);
+        if (word) {
+            offset += dir > 0 ? __builtin_ctzll(word) : __builtin_clzll(word);
+            break;
+        }
+        offset += left_in_word;
+    }
+    return offset < limit ? offset : limit;
+}
+
+void world_refresh(World *world)
+{
+    memset(world->stats.population, 0, sizeof(world->stats.population));
+    world->stats.particles = 0;
+    memset(world->columns, 0, sizeof(*world->columns) * world->width * world->column_words);
+    memset(world->occupied, 0, sizeof(*world->occupied) * world->height * world->row_words);
+    memset(world->fluids, 0, sizeof(*world->fluids) * world->height * world->row_words);
+
+    for (size_t cy = 0; cy < world->chunks_height; ++cy) {
+        for (size_t cx = 0; cx < world->chunks_width; ++cx) {
+            Chunk *chunk = &world->chunks[cx + cy * world->chunks_width];
+            int min_x = cx * CHUNK_SIZE, min_y = cy * CHUNK_SIZE;
+            int max_x = CLAMP(min_x + CHUNK_SIZE, 0, (int)world->width);
+            int max_y = CLAMP(min_y + CHUNK_SIZE, 0, (int)world->height);
+
+            chunk->population = 0;
+            for (int y = min_y; y < max_y; ++y) {
+                const uint8_t *row = &world->types[world_get_index(world, 0, y)];
+                for (int x = min_x; x < max_x; ++x) {
+                    world->stats.population[row[x]] += 1;
+                    chunk->population += row[x] != PT_EMPTY;
+                    world_bitmaps_update(world, world_get_index(world, x, y), PT_EMPTY, row[x]);
+                }
+            }
+            world->stats.particles += chunk->population;
+
+            chunk->next_min_x = chunk->changed_min_x = min_x;
+            chunk->next_min_y = chunk->changed_min_y = min_y;
+            chunk->next_max_x = chunk->changed_max_x = max_x;
+            chunk->next_max_y = chunk->changed_max_y = max_y;
+        }
+    }
+}
+
+World_Stats world_get_stats(World *world)
+{
+    return world->stats;
+}
+
+uint64_t world_checksum(World *world)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < world->width * world->height; ++i) {
+        hash = (hash ^ world->types[i]) * 0x100000001b3ull;
+        hash = (hash ^ world->shades[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+Vector2i world_get_pos(World *world, size_t index) {
+    return (Vector2i) {
+        .x = index % world->width,
+        .y = index / world->width,
+    };
+}
+
+
+size_t world_get_index(World *world, size_t x, size_t y) {
+    return x + y * world->width;
+}
+
+Particle_Type world_get_at_index(World *world, size_t i) {
+    return world->types[i];
+}
+
+Particle_Type world_get_at(World *world, size_t x, size_t y) {
+    return world_get_at_index(world, world_get_index(world, x, y));
+}
+
+Color world_get_color(World *world, size_t i) {
+    return PARTICLE_PALETTE[world->types[i]][world->shades[i]];
+}
+
+bool world_in_bounds(World *world, size_t x, size_t y) {
+    return x < world->width && y < world->height;
+}
+
+bool world_is_empty(World *world, size_t x, size_t y) {
+    if (!world_in_bounds(world, x, y)) return false;
+    uint64_t word = __atomic_load_n(&world->occupied[y * world->row_words + x / 64], __ATOMIC_RELAXED);
+    return !(word & (1ull << (x % 64)));
+}
+
+void world_set_type(World *world, size_t x, size_t y, Particle_Type type)
+{
+    size_t i = world_get_index(world, x, y);
+    Particle_Type old = world->types[i];
+    world_bitmaps_update(world, i, old, type);
+    if (old != type) {
+        world_wake(world, x, y);
+        world->stats.population[old] -= 1;
+        world->stats.population[type] += 1;
+        if (old == PT_EMPTY) {
+            world->stats.particles += 1;
+            world_get_chunk(world, x, y)->population += 1;
+        } else if (type == PT_EMPTY) {
+            world->stats.particles -= 1;
+            world_get_chunk(world, x, y)->population -= 1;
+        }
+    }
+    world->types[i] = type;
+    world->shades[i] = type == PT_EMPTY ? 0 : rng_below(&world->rng, PALETTE_SHADES);
+    world->flags[i] = 0;
+    world->velocity[i] = 0;
+}
+
+static Chunk *world_get_chunk_at_index(World *world, size_t i)
+{
+    Vector2i pos = world_get_pos(world, i);
+    return world_get_chunk(world, pos.x, pos.y);
+}
+
+void world_swap(World *world, size_t a, size_t b)
+{
+    // Moving a particle into an empty cell of another chunk changes the
+    // population of both. Chunks of different phases can do that to the same
+    // neighbour at once.
+    world_bitmaps_update(world, a, world->types[a], world->types[b]);
+    world_bitmaps_update(world, b, world->types[b], world->types[a]);
+    if ((world->types[a] == PT_EMPTY) != (world->types[b] == PT_EMPTY)) {
+        Chunk *chunk_a = world_get_chunk_at_index(world, a);
+        Chunk *chunk_b = world_get_chunk_at_index(world, b);
+        if (chunk_a != chunk_b) {
+            size_t delta_a = world->types[a] == PT_EMPTY ? 1 : -1;
+            __atomic_fetch_add(&chunk_a->population, delta_a, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&chunk_b->population, delta_a, __ATOMIC_RELAXED);
+        }
+    }
+
+    uint8_t type = world->types[a];
+    uint8_t shade = world->shades[a];
+    uint8_t flags = world->flags[a];
+    int8_t velocity = world->velocity[a];
+
+    world->types[a] = world->types[b];
+    world->shades[a] = world->shades[b];
+    world->flags[a] = world->flags[b];
+    world->velocity[a] = world->velocity[b];
+
+    world->types[b] = type;
+    world->shades[b] = shade;
+    world->flags[b] = flags;
+    world->velocity[b] = velocity;
+}
+
+Chunk *world_get_chunk(World *world, size_t x, size_t y)
+{
+    return &world->chunks[(x / CHUNK_SIZE) + (y / CHUNK_SIZE) * world->chunks_width];
+}
+
+// In parallel mode a chunk sitting between two chunks of the same phase can be
+// woken from both of them at once.
+static void atomic_min_int(int *dst, int value)
+{
+    int current = __atomic_load_n(dst, __ATOMIC_RELAXED);
+    while (value < current && !__atomic_compare_exchange_n(dst, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static void atomic_max_int(int *dst, int value)
+{
+    int current = __atomic_load_n(dst, __ATOMIC_RELAXED);
+    while (value > current && !__atomic_compare_exchange_n(dst, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+void world_wake(World *world, size_t x, size_t y)
+{
+    world_wake_rect(world, x, y, x + 1, y + 1);
+}
+
+void world_wake_rect(World *world, int x0, int y0, int x1, int y1)
+{
+    x0 -= WORLD_MAX_SPREAD + 1;
+    y0 -= CHUNK_DIRTY_MARGIN;
+    x1 += WORLD_MAX_SPREAD + 1;
+    y1 += CHUNK_DIRTY_MARGIN;
+    x0 = CLAMP(x0, 0, (int)world->width);
+    y0 = CLAMP(y0, 0, (int)world->height);
+    x1 = CLAMP(x1, 0, (int)world->width);
+    y1 = CLAMP(y1, 0, (int)world->height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    for (int cy = y0 / CHUNK_SIZE; cy <= (y1 - 1) / CHUNK_SIZE; ++cy) {
+        for (int cx = x0 / CHUNK_SIZE; cx <= (x1 - 1) / CHUNK_SIZE; ++cx) {
+            Chunk *chunk = &world->chunks[cx + cy * world->chunks_width];
+            int min_x = CLAMP(x0, cx * CHUNK_SIZE, (cx + 1) * CHUNK_SIZE);
+            int min_y = CLAMP(y0, cy * CHUNK_SIZE, (cy + 1) * CHUNK_SIZE);
+            int max_x = CLAMP(x1, cx * CHUNK_SIZE, (cx + 1) * CHUNK_SIZE);
+            int max_y = CLAMP(y1, cy * CHUNK_SIZE, (cy + 1) * CHUNK_SIZE);
+            atomic_min_int(&chunk->next_min_x, min_x);
+            atomic_min_int(&chunk->next_min_y, min_y);
+            atomic_max_int(&chunk->next_max_x, max_x);
+            atomic_max_int(&chunk->next_max_y, max_y);
+            atomic_min_int(&chunk->changed_min_x, min_x);
+            atomic_min_int(&chunk->changed_min_y, min_y);
+            atomic_max_int(&chunk->changed_max_x, max_x);
+            atomic_max_int(&chunk->changed_max_y, max_y);
+        }
+    }
+}
+
+size_t world_take_changed_rects(World *world, World_Rect *rects)
+{
+    size_t count = 0;
+    for (size_t cy = world->region.min_y; cy < world->region.max_y; ++cy) {
+        World_Rect *run = NULL;
+        for (size_t cx = world->region.min_x; cx < world->region.max_x; ++cx) {
+            Chunk *chunk = &world->chunks[cx + cy * world->chunks_width];
+            if (chunk->changed_min_x >= chunk->changed_max_x || chunk->changed_min_y >= chunk->changed_max_y) {
+                run = NULL;
+                continue;
+            }
+
+            if (run == NULL) {
+                run = &rects[count++];
+                *run = (World_Rect) {
+                    .x = chunk->changed_min_x,
+                    .y = chunk->changed_min_y,
+                    .width = chunk->changed_max_x - chunk->changed_min_x,
+                    .height = chunk->changed_max_y - chunk->changed_min_y,
+                };
+            } else {
+                int min_y = run->y;
+                int max_y = run->y + run->height;
+                if (chunk->changed_min_y < min_y) min_y = chunk->changed_min_y;
+                if (chunk->changed_max_y > max_y) max_y = chunk->changed_max_y;
+                run->y = min_y;
+                run->width = chunk->changed_max_x - run->x;
+                run->height = max_y - min_y;
+            }
+
+            chunk->changed_min_x = INT_MAX;
+            chunk->changed_min_y = INT_MAX;
+            chunk->changed_max_x = 0;
+            chunk->changed_max_y = 0;
+        }
+    }
+    return count;
+}
+
+void world_copy_colors(World *world, World_Rect rect, Color *pixels)
+{
+    for (int y = 0; y < rect.height; ++y) {
+        size_t i = world_get_index(world, rect.x, rect.y + y);
+        colors_convert(&world->types[i], &world->shades[i], pixels, rect.width);
+        pixels += rect.width;
+    }
+}
+
+void world_copy_colors_scaled(World *world, World_Rect rect, Color *pixels, size_t scale)
+{
+    size_t stride = rect.width * scale;
+    for (int y = 0; y < rect.height; ++y) {
+        size_t i = world_get_index(world, rect.x, rect.y + y);
+        colors_convert_scaled(&world->types[i], &world->shades[i], pixels, rect.width, scale);
+        for (size_t k = 1; k < scale; ++k) memcpy(&pixels[k * stride], pixels, stride * sizeof(*pixels));
+        pixels += stride * scale;
+    }
+}
+
+void world_set_region(World *world, World_Rect rect)
+{
+    int x0 = CLAMP(rect.x, 0, (int)world->width);
+    int y0 = CLAMP(rect.y, 0, (int)world->height);
+    int x1 = CLAMP(rect.x + rect.width, x0, (int)world->width);
+    int y1 = CLAMP(rect.y + rect.height, y0, (int)world->height);
+    world->region.min_x = x0 / CHUNK_SIZE;
+    world->region.min_y = y0 / CHUNK_SIZE;
+    world->region.max_x = (x1 + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    world->region.max_y = (y1 + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// Promote the rects accumulated during the previous tick and put every chunk
+// that saw no change to sleep. Chunks outside the region keep their next
+// rect, and with it anything that woke them, for whenever the region comes
+// back to them.
+//
+// The chunk stats are counted along the way, as of the start of the tick,
+// instead of in a pass of their own. Everything outside the region counts
+// as settled.
+static void world_begin_tick(World *world)
+{
+    world->stats.active_chunks = 0;
+    world->stats.settled = world->stats.particles;
+    for (size_t cy = world->region.min_y; cy < world->region.max_y; ++cy) {
+        for (size_t cx = world->region.min_x; cx < world->region.max_x; ++cx) {
+            Chunk *chunk = &world->chunks[cx + cy * world->chunks_width];
+            chunk->min_x = chunk->next_min_x;
+            chunk->min_y = chunk->next_min_y;
+            chunk->max_x = chunk->next_max_x;
+            chunk->max_y = chunk->next_max_y;
+            chunk->awake = chunk->min_x < chunk->max_x && chunk->min_y < chunk->max_y;
+            if (chunk->awake) {
+                world->stats.active_chunks += 1;
+                world->stats.settled -= chunk->population;
+            }
+
+            chunk->next_min_x = INT_MAX;
+            chunk->next_min_y = INT_MAX;
+            chunk->next_max_x = 0;
+            chunk->next_max_y = 0;
+        }
+    }
+}
+
+
+static uint8_t world_updated_flag(World *world)
+{
+    return world->tick & 1 ? PF_UPDATED_ODD : PF_UPDATED_EVEN;
+}
+
+// Bresenham's line algorith:
+// walk the particle from src towards dst until something blocks it and return
+// where it ended up.
+static size_t world_walk_particle(World_Worker *w, size_t src_index, size_t dst_index)
+{
+    World *world = w->world;
+    Particle_Type mover = world->types[src_index];
+    size_t current = src_index;
+
+    Vector2i dst = world_get_pos(world, dst_index);
+    Vector2i src = world_get_pos(world, src_index);
+
+    int x0 = src.x;
+    int y0 = src.y;
+    int x1 = dst.x;
+    int y1 = dst.y;
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx - dy;
+
+    // Straight falls through empty cells take a single swap, whatever their
+    // length. Anything else, sinking through liquids included, goes cell by
+    // cell.
+    size_t fall = dx == 0 && y1 > y0 ? world_column_free(world, x0, y0 + 1, y1 - y0) : 0;
+    if (fall > 0) {
+        current = world_get_index(world, x0, y0 + fall);
+        world_swap(world, src_index, current);
+        y0 = y1;
+    }
+
+    while (x0 != x1 || y0 != y1) {
+        int e2 = 2 * err;
+        if (e2 > -dy) {
+            err -= dy;
+            x0 += sx;
+        }
+        if (e2 < dx) {
+            err += dx;
+            y0 += sy;
+        }
+
+        // process cell at (x0, y0)
+        size_t next = world_get_index(world, x0, y0);
+        if (!world_can_enter(mover, world->types[next], y1 - src.y)) break;
+        world_swap(world, current, next);
+        current = next;
+    }
+
+    if (current != src_index) {
+        Vector2i end = world_get_pos(world, current);
+        world->flags[current] |= world_updated_flag(world);
+        world_wake(world, src.x, src.y);
+        world_wake(world, end.x, end.y);
+        w->moved += 1;
+    }
+
+    return current;
+}
+
+void world_move_particle(World_Worker *w, size_t x_src, size_t y_src, size_t x_dst, size_t y_dst)
+{
+    World *world = w->world;
+    Particle_Update update = {
+        .src = world_get_index(world, x_src, y_src),
+        .dst = world_get_index(world, x_dst, y_dst),
+    };
+
+    if (world->engine == WORLD_ENGINE_IN_PLACE) {
+        // Same rule as the filter in world_update_particles(): a move only
+        // happens while its destination is still free.
+        w->updates += 1;
+        if (!world_can_enter(world->types[update.src], world->types[update.dst], (int)y_dst - (int)y_src)) return;
+        world_walk_particle(w, update.src, update.dst);
+        return;
+    }
+
+    arena_da_append(&w->scratch, &w->particle_updates, update);
+}
+
+void world_update_particles(World_Worker *w)
+{
+    World *world = w->world;
+    w->updates += w->particle_updates.count;
+    if (w->particle_updates.count < 1) return;
+
+    // remove moves that have their dst filled
+    uint64_t start = prof_begin();
+    for (size_t i = 0; i < w->particle_updates.count; ++i) {
+        Particle_Update *it = &w->particle_updates.items[i];
+        // Moves span a few rows at most.
+        int dy = (int)((ptrdiff_t)(it->dst / world->width) - (ptrdiff_t)(it->src / world->width));
+        // A blocked move is left in place as one that goes nowhere, so the
+        // shuffle below draws the same numbers either way.
+        if (!world_can_enter(world->types[it->src], world->types[it->dst], dy)) it->dst = it->src;
+    }
+
+    prof_end(PROF_FILTER, start);
+
+    // shuffle the array using the Fisher-Yates algorithm
+    start = prof_begin();
+    for (size_t i = 0; i + 1 < w->particle_updates.count; ++i) {
+        size_t j = i + rng_below(&w->rng, w->particle_updates.count - i);
+        Particle_Update temp = w->particle_updates.items[j];
+        w->particle_updates.items[j] = w->particle_updates.items[i];
+        w->particle_updates.items[i] = temp;
+    }
+
+    prof_end(PROF_SHUFFLE, start);
+
+    start = prof_begin();
+    for (size_t i = 0; i < w->particle_updates.count; ++i) {
+        Particle_Update it = w->particle_updates.items[i];
+        if (it.dst != it.src) world_walk_particle(w, it.src, it.dst);
+    }
+    prof_end(PROF_RESOLVE, start);
+
+    w->particle_updates.count = 0;
+}
+
+bool world_can_enter(Particle_Type mover, Particle_Type target, int dy)
+{
+    if (target == PT_EMPTY) return true;
+    if (mover == PT_EMPTY || dy == 0) return false;
+    if (!(MATERIALS[target].props & (PP_LIQUID | PP_GAS))) return false;
+    return dy > 0
+        ? MATERIALS[mover].density > MATERIALS[target].density
+        : MATERIALS[mover].density < MATERIALS[target].density;
+}
+
+// Whether the particle at (x, y) may move to (x + dx, y + dy). The bitmaps
+// settle empty and solid targets, only fluids need both types.
+static bool world_can_move(World *world, size_t x, size_t y, int dx, int dy)
+{
+    size_t tx = x + dx, ty = y + dy;
+    if (!world_in_bounds(world, tx, ty)) return false;
+    size_t word = ty * world->row_words + tx / 64;
+    uint64_t bit = 1ull << (tx % 64);
+    if (!(__atomic_load_n(&world->occupied[word], __ATOMIC_RELAXED) & bit)) return true;
+    if (!(__atomic_load_n(&world->fluids[word], __ATOMIC_RELAXED) & bit)) return false;
+    return world_can_enter(world_get_at(world, x, y), world_get_at(world, tx, ty), dy);
+}
+
+// Moves towards one of the two cells at (x - 1, y + dy) and (x + 1, y + dy),
+// picking randomly when both are free.
+static bool world_move_diagonal(World_Worker *w, size_t x, size_t y, int dy)
+{
+    bool left = world_can_move(w->world, x, y, -1, dy);
+    bool right = world_can_move(w->world, x, y, 1, dy);
+
+    if (left && right) {
+        left = rng_bit(&w->rng);
+        right = !left;
+    }
+
+    if (left)
+    world_move_particle(w, x, y, x - 1, y + dy);
+    else if (right)
+    world_move_particle(w, x, y, x + 1, y + dy);
+
+    return left || right;
+}
+
+bool world_move_down(World_Worker *w, size_t x, size_t y, bool free_falling)
+{
+    World *world = w->world;
+    size_t i = world_get_index(world, x, y);
+    size_t reach = 1;
+    if (free_falling) reach += world->velocity[i];
+
+    size_t fall = world_column_free(world, x, y + 1, reach);
+    if (fall == 0) {
+        // Landed, or sinking through something lighter a cell at a time.
+        world->velocity[i] = 0;
+        if (!world_can_move(world, x, y, 0, 1)) return false;
+        fall = 1;
+    } else if (fall < reach) {
+        world->velocity[i] = 0;
+    } else if (world->velocity[i] < WORLD_TERMINAL_VELOCITY) {
+        world->velocity[i] += 1;
+    }
+
+    world_move_particle(w, x, y, x, y + fall);
+    return true;
+}
+
+bool world_move_down_side(World_Worker *w, size_t x, size_t y)
+{
+    if (world_can_move(w->world, x, y, -1, 1) || world_can_move(w->world, x, y, 1, 1)) {
+        w->world->velocity[world_get_index(w->world, x, y)] = 0;
+    }
+    return world_move_diagonal(w, x, y, 1);
+}
+
+// How far a particle flowing along a run of `run` empty cells may go. It
+// stops a cell short of whatever ends the run, so it never ends up next to
+// another particle that would push it back.
+static size_t world_flow_distance(size_t run, size_t spread)
+{
+    if (run > spread) return spread;
+    return run > 0 ? run - 1 : 0;
+}
+
+// Distance to the nearest cell of `type` past the run of empty cells from
+// (x, y) on in direction `dir`, looking `limit` cells ahead. 0 if there is
+// none or something else ends the run.
+static size_t world_find_same(World *world, size_t x, size_t y, size_t limit, int dir, Particle_Type type)
+{
+    size_t run = world_row_scan(world, x, y, limit, dir, false);
+    if (run >= limit) return 0;
+    size_t at = dir > 0 ? x + run : x - run;
+    return world_get_at(world, at, y) == type ? run + 1 : 0;
+}
+
+// Number of occupied cells from (x, y) on in direction `dir`, `limit` at most.
+static size_t world_run_length(World *world, size_t x, size_t y, size_t limit, int dir)
+{
+    size_t left_in_row = dir > 0 ? world->width - x : x + 1;
+    return world_row_scan(world, x, y, limit < left_in_row ? limit : left_in_row, dir, true);
+}
+
+// Liquids (and gases, upside down) flow sideways along the run of empty cells
+// next to them, up to `spread_factor` cells in one move:
+//  - towards the nearest cell of the run they can fall out of, if any,
+//  - otherwise on in the direction they are already flowing,
+//  - otherwise away from a neighbour of the same liquid, off the edge of a
+//    body at least two cells high,
+//  - otherwise towards the next run of the same liquid along the row, to
+//    join it: from a particle on its own always, from the end of a run when
+//    the next one is longer.
+// None of these apply to the particles of a level surface, so a body of
+// liquid that has levelled out into runs with no gaps stops moving and its
+// chunks go to sleep instead of shuffling particles left and right forever.
+bool world_move_side(World_Worker *w, size_t x, size_t y)
+{
+    World *world = w->world;
+    size_t i = world_get_index(world, x, y);
+    Particle_Type type = world->types[i];
+    const Material_Info *material = &MATERIALS[type];
+    int dy = (material->props & PP_GAS) ? -1 : 1;
+    uint8_t flow = world->flags[i] & (PF_FLOW_LEFT | PF_FLOW_RIGHT);
+    world->flags[i] &= ~flow;
+
+    size_t spread = CLAMP(material->spread_factor, 1, WORLD_MAX_SPREAD);
+    const uint8_t *row = &world->types[world_get_index(world, 0, y)];
+
+    // One cell further than the particle may go, to see what ends the run.
+    size_t reach_right = world->width - 1 - x < spread + 1 ? world->width - 1 - x : spread + 1;
+    size_t reach_left = x < spread + 1 ? x : spread + 1;
+    Particle_Type neighbour_right = reach_right > 0 ? row[x + 1] : PT_STONE;
+    Particle_Type neighbour_left = reach_left > 0 ? row[x - 1] : PT_STONE;
+    // Most particles of a liquid body are boxed in, leave them before scanning.
+    if (neighbour_right != PT_EMPTY && neighbour_left != PT_EMPTY) return false;
+
+    size_t run_right = world_row_scan(world, x + 1, y, reach_right, 1, false);
+    size_t run_left = world_row_scan(world, x - 1, y, reach_left, -1, false);
+
+    // Distance to the first cell of the run with an empty cell beyond it,
+    // there is none on the last row.
+    size_t right = 0, left = 0;
+    if (world_in_bounds(world, x, y + dy)) {
+        right = world_row_scan(world, x + 1, y + dy, run_right < spread ? run_right : spread, 1, true) + 1;
+        left = world_row_scan(world, x - 1, y + dy, run_left < spread ? run_left : spread, -1, true) + 1;
+        if (right > run_right || right > spread) right = 0;
+        if (left > run_left || left > spread) left = 0;
+    }
+
+    if (left && right) {
+        if (left < right) right = 0;
+        else if (right < left) left = 0;
+        else if (rng_bit(&w->rng)) right = 0;
+        else left = 0;
+    } else if (!left && !right) {
+        if (flow == PF_FLOW_RIGHT) right = world_flow_distance(run_right, spread);
+        if (flow == PF_FLOW_LEFT) left = world_flow_distance(run_left, spread);
+        if (!left && !right) {
+            // Not away from a neighbour it flowed up to, see below.
+            if (neighbour_left == type && flow != PF_FLOW_LEFT) right = world_flow_distance(run_right, spread);
+            else if (neighbour_right == type && flow != PF_FLOW_RIGHT) left = world_flow_distance(run_left, spread);
+        }
+        if (!left && !right) {
+            size_t far_right = world->width - 1 - x < WORLD_MAX_SPREAD + 1 ? world->width - 1 - x : WORLD_MAX_SPREAD + 1;
+            size_t far_left = x < WORLD_MAX_SPREAD + 1 ? x : WORLD_MAX_SPREAD + 1;
+            if (neighbour_right == PT_EMPTY) right = world_find_same(world, x + 1, y, far_right, 1, type);
+            if (neighbour_left == PT_EMPTY) left = world_find_same(world, x - 1, y, far_left, -1, type);
+            if (neighbour_left != type && neighbour_right != type) {
+                // On its own, towards the nearest.
+                if (left && right) {
+                    if (left < right || (left == right && rng_bit(&w->rng))) right = 0;
+                    else left = 0;
+                }
+            } else if (right) {
+                // At the end of a run, over to the next one if that is
+                // longer, or as long and to the right so two runs never trade
+                // particles back and forth. Both are measured as far out as
+                // the gap leaves of the cells a change wakes.
+                size_t limit = WORLD_MAX_SPREAD + 2 - right;
+                if (world_run_length(world, x + right, y, limit, 1) < world_run_length(world, x, y, limit, -1)) right = 0;
+            } else if (left) {
+                size_t limit = WORLD_MAX_SPREAD + 2 - left;
+                if (world_run_length(world, x - left, y, limit, -1) <= world_run_length(world, x, y, limit, 1)) left = 0;
+            }
+            // As far as the cell next to it, `spread` cells at most.
+            if (right) right = right - 1 < spread ? right - 1 : spread;
+            if (left) left = left - 1 < spread ? left - 1 : spread;
+        }
+        if (!left && !right) {
+            // Held up, carries on once whatever is in the way moves off.
+            world->flags[i] |= flow;
+            return false;
+        }
+    }
+
+    // Going over the edge keeps the flow too, so a particle that falls down a
+    // step carries on down the next one.
+    if (left) {
+        world->flags[i] |= PF_FLOW_LEFT;
+        world_move_particle(w, x, y, x - left, y);
+    } else {
+        world->flags[i] |= PF_FLOW_RIGHT;
+        world_move_particle(w, x, y, x + right, y);
+    }
+
+    return true;
+}
+
+bool world_move_up(World_Worker *w, size_t x, size_t y)
+{
+    if (!world_can_move(w->world, x, y, 0, -1)) return false;
+    world_move_particle(w, x, y, x, y - 1);
+    return true;
+}
+
+bool world_move_up_side(World_Worker *w, size_t x, size_t y)
+{
+    return world_move_diagonal(w, x, y, -1);
+}
+
+static void world_update_cell(World_Worker *w, size_t x, size_t y)
+{
+    World *world = w->world;
+    size_t i = world_get_index(world, x, y);
+    Material_Kernel update = MATERIALS[world->types[i]].update;
+    if (update == NULL) return;
+
+    if (world->flags[i] & world_updated_flag(world)) return;
+    world->flags[i] &= ~(PF_UPDATED_EVEN | PF_UPDATED_ODD);
+
+    update(w, x, y);
+}
+
+// The intent engine always sweeps left to right since the shuffle takes care
+// of the ordering, the in-place engine picks a direction for every row.
+static bool world_row_reversed(World_Worker *w)
+{
+    return w->world->engine == WORLD_ENGINE_IN_PLACE && rng_bit(&w->rng);
+}
+
+// Bits of word `k` of a row that fall inside [min_x, max_x).
+static uint64_t world_span_mask(size_t k, size_t min_x, size_t max_x)
+{
+    size_t lo = min_x > k * 64 ? min_x - k * 64 : 0;
+    size_t hi = max_x < (k + 1) * 64 ? max_x - k * 64 : 64;
+    uint64_t mask = hi == 64 ? UINT64_MAX : (1ull << hi) - 1;
+    return mask & ~((1ull << lo) - 1);
+}
+
+static void world_update_span(World_Worker *w, size_t y, size_t min_x, size_t max_x, bool reversed)
+{
+    World *world = w->world;
+    if (!world->sweep_occupied) {
+        if (reversed) {
+            for (size_t x = max_x; x-- > min_x;) world_update_cell(w, x, y);
+        } else {
+            for (size_t x = min_x; x < max_x; ++x) world_update_cell(w, x, y);
+        }
+        return;
+    }
+    if (min_x >= max_x) return;
+
+    // A word is read when the sweep gets to it. Moving in place can only
+    // fill its later cells with particles that already moved this tick, which
+    // the sweep would leave alone anyway.
+    const uint64_t *row = &world->occupied[y * world->row_words];
+    size_t first = min_x / 64, last = (max_x - 1) / 64;
+    for (size_t n = 0; n <= last - first; ++n) {
+        size_t k = reversed ? last - n : first + n;
+        uint64_t mask = __atomic_load_n(&row[k], __ATOMIC_RELAXED) & world_span_mask(k, min_x, max_x);
+        while (mask) {
+            int bit = reversed ? 63 - __builtin_clzll(mask) : __builtin_ctzll(mask);
+            mask &= ~(1ull << bit);
+            world_update_cell(w, k * 64 + bit, y);
+        }
+    }
+}
+
+static void world_step_serial(World *world)
+{
+    World_Worker *w = &world->workers[0];
+
+    size_t min_y = world->region.min_y * CHUNK_SIZE;
+    size_t max_y = world->region.max_y * CHUNK_SIZE;
+    if (max_y > world->height) max_y = world->height;
+    size_t min_cx = world->region.min_x, count = world->region.max_x - min_cx;
+
+    uint64_t start = prof_begin();
+    for (size_t y = max_y; y-- > min_y && y > 0;) {
+        Chunk *row = &world->chunks[(y / CHUNK_SIZE) * world->chunks_width + min_cx];
+        bool reversed = world_row_reversed(w);
+        for (size_t i = 0; i < count; ++i) {
+            Chunk *chunk = &row[reversed ? count - 1 - i : i];
+            if (!chunk->awake || (int)y < chunk->min_y || (int)y >= chunk->max_y) continue;
+
+            world_update_span(w, y, chunk->min_x, chunk->max_x, reversed);
+        }
+    }
+    prof_end(PROF_SWEEP, start);
+    world_update_particles(w);
+}
+
+static uint64_t world_chunk_seed(World *world, size_t chunk)
+{
+    return rng_mix(world->seed ^ rng_mix(world->tick ^ rng_mix(chunk)));
+}
+
+// Sweep and resolve a single chunk. Every move stays within CHUNK_DIRTY_MARGIN
+// of the chunk, well inside the neighbouring chunks that belong to other phases.
+static void world_update_chunk(void *ctx, size_t index, size_t worker)
+{
+    World *world = ctx;
+    World_Worker *w = &world->workers[worker];
+    size_t chunk_index = world->phase_chunks[index];
+    Chunk *chunk = &world->chunks[chunk_index];
+
+    if (world->deterministic) rng_seed(&w->rng, world_chunk_seed(world, chunk_index));
+
+    uint64_t start = prof_begin();
+    for (size_t y = chunk->max_y; y-- > (size_t)chunk->min_y && y > 0;) {
+        world_update_span(w, y, chunk->min_x, chunk->max_x, world_row_reversed(w));
+    }
+    prof_end(PROF_SWEEP, start);
+    world_update_particles(w);
+}
+
+static void world_step_parallel(World *world)
+{
+    Arena_Mark mark = arena_snapshot(&world->scratch);
+    size_t region_chunks = (world->region.max_x - world->region.min_x) * (world->region.max_y - world->region.min_y);
+    world->phase_chunks = arena_alloc(&world->scratch, sizeof(size_t) * (region_chunks > 0 ? region_chunks : 1));
+    for (size_t phase = 0; phase < 4; ++phase) {
+        // The phase of a chunk goes by its place in the world, not in the
+        // region, so the result does not depend on where the region starts.
+        size_t count = 0;
+        for (size_t cy = world->region.min_y + (world->region.min_y + phase / 2) % 2; cy < world->region.max_y; cy += 2) {
+            for (size_t cx = world->region.min_x + (world->region.min_x + phase % 2) % 2; cx < world->region.max_x; cx += 2) {
+                size_t i = cx + cy * world->chunks_width;
+                if (world->chunks[i].awake) world->phase_chunks[count++] = i;
+            }
+        }
+        pool_run(world->pool, count, world_update_chunk, world);
+    }
+    arena_rewind(&world->scratch, mark);
+    world->phase_chunks = NULL;
+}
+
+void world_step(World *world)
+{
+    for (size_t i = 0; i < world->threads; ++i) {
+        World_Worker *w = &world->workers[i];
+        w->updates = 0;
+        w->moved = 0;
+
+        size_t capacity = w->particle_updates.capacity;
+        if (capacity < ARENA_DA_INIT_CAP) capacity = ARENA_DA_INIT_CAP;
+        arena_reset(&w->scratch);
+        w->particle_updates = (Particle_Updates) {
+            .items = arena_alloc(&w->scratch, capacity * sizeof(*w->particle_updates.items)),
+            .capacity = capacity,
+        };
+    }
+    world_begin_tick(world);
+
+    if (world->parallel) {
+        world_step_parallel(world);
+    } else {
+        world_step_serial(world);
+    }
+
+    world->stats.updates = 0;
+    world->stats.moved = 0;
+    for (size_t i = 0; i < world->threads; ++i) {
+        world->stats.updates += world->workers[i].updates;
+        world->stats.moved += world->workers[i].moved;
+    }
+
+    world->tick += 1;
+    world->stats.ticks = world->tick;
+    prof_tick();
+}
+
+// High bit of every byte of `v` that is zero.
+static uint64_t swar_zero_bytes(uint64_t v)
+{
+    return ~(((v & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | v) & 0x8080808080808080ull;
+}
+
+void world_paint_span(World *world, size_t y, size_t x0, size_t x1, Particle_Type type, uint32_t threshold)
+{
+    size_t row = world_get_index(world, 0, y);
+    uint8_t *types = &world->types[row];
+    Chunk *chunks = &world->chunks[(y / CHUNK_SIZE) * world->chunks_width];
+    uint64_t threshold_bytes = 0x0101010101010101ull * (threshold > 128 ? 128 : threshold);
+    uint64_t shades = 0;
+    size_t shades_left = 0;
+    size_t added = 0;
+
+    // Eight cells at a time: one mask of the empty cells, one of the cells
+    // whose random byte passes the threshold.
+    for (size_t x = x0; x < x1; x += 8) {
+        size_t count = x1 - x < 8 ? x1 - x : 8;
+        uint64_t cells = UINT64_MAX;
+        memcpy(&cells, &types[x], count);
+        uint64_t empty = swar_zero_bytes(cells);
+        uint64_t roll = rng_next(&world->rng) & 0x7f7f7f7f7f7f7f7full;
+        uint64_t spawn = ~((roll | 0x8080808080808080ull) - threshold_bytes) & 0x8080808080808080ull;
+
+        for (uint64_t mask = empty & spawn; mask; mask &= mask - 1) {
+            size_t i = x + __builtin_ctzll(mask) / 8;
+            if (shades_left == 0) {
+                shades = rng_next(&world->rng);
+                shades_left = 64 / 4;
+            }
+            types[i] = type;
+            world_bitmaps_update(world, row + i, PT_EMPTY, type);
+            world->shades[row + i] = shades % PALETTE_SHADES;
+            world->flags[row + i] = 0;
+            world->velocity[row + i] = 0;
+            shades >>= 4;
+            shades_left -= 1;
+            chunks[i / CHUNK_SIZE].population += 1;
+            added += 1;
+        }
+    }
+
+    world->stats.population[PT_EMPTY] -= added;
+    world->stats.population[type] += added;
+    world->stats.particles += added;
+}
+
+void world_erase_span(World *world, size_t y, size_t x0, size_t x1)
+{
+    size_t row = world_get_index(world, 0, y);
+    uint8_t *types = &world->types[row];
+    Chunk *chunks = &world->chunks[(y / CHUNK_SIZE) * world->chunks_width];
+
+    for (size_t x = x0; x < x1; ++x) {
+        if (types[x] == PT_EMPTY) continue;
+        world_bitmaps_update(world, row + x, types[x], PT_EMPTY);
+        world->stats.population[types[x]] -= 1;
+        world->stats.population[PT_EMPTY] += 1;
+        world->stats.particles -= 1;
+        chunks[x / CHUNK_SIZE].population -= 1;
+    }
+    memset(&types[x0], PT_EMPTY, x1 - x0);
+    memset(&world->shades[row + x0], 0, x1 - x0);
+    memset(&world->flags[row + x0], 0, x1 - x0);
+    memset(&world->velocity[row + x0], 0, x1 - x0);
+}
@@ -0,0 +1,353 @@
+#ifndef WORLD_H_
+#define WORLD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+// Only the plain data types (Color, Vector2) are used from raylib here, so the
+// simulation can be built and linked without raylib or a window.
+#include <raylib.h>
+#include <arena.h>
+
+#include "pool.h"
+#include "rng.h"
+
+#define WORLD_DEFAULT_SEED 0x5eed
+
+#define CLAMP(value, low, high) (((value) < (low)) ? (low) : (((value) > (high)) ? (high) : (value)))
+
+typedef enum Particle_Properties : uint32_t {
+    PP_NONE           = 1 << 0,
+
+    PP_SOLID          = 1 << 1,
+    PP_LIQUID         = 1 << 2,
+    PP_GAS            = 1 << 3,
+
+    PP_MOVE_DOWN      = 1 << 4,
+    PP_MOVE_DOWN_SIDE = 1 << 5,
+    PP_MOVE_SIDE      = 1 << 6,
+    PP_MOVE_UP        = 1 << 7,
+    PP_MOVE_UP_SIDE   = 1 << 8,
+} Particle_Properties;
+
+typedef enum Particle_Type : uint8_t {
+    PT_EMPTY = 0,
+    PT_SAND,
+    PT_WATER,
+    PT_STONE,
+    PT_OIL,
+    PT_GAS,
+    PT_LAVA,
+    PT_WOOD,
+    PT_COUNT
+} Particle_Type;
+
+typedef enum Particle_Flags : uint8_t {
+    PF_FREE_FALLING = 1 << 0,
+    // Set on a particle that already moved this tick, so a sweep that meets
+    // it again further down (in-place engine) or in the chunk it fell into
+    // (parallel mode) leaves it alone. Even and odd ticks use different bits,
+    // so a mark left over from the previous tick never has to be cleared
+    // before it stops counting.
+    PF_UPDATED_EVEN = 1 << 1,
+    PF_UPDATED_ODD  = 1 << 2,
+    // A liquid pushed off the edge of its body keeps flowing this way until
+    // it runs into something or finds somewhere to fall.
+    PF_FLOW_LEFT    = 1 << 3,
+    PF_FLOW_RIGHT   = 1 << 4,
+} Particle_Flags;
+
+// Each particle picks one of PALETTE_SHADES brightness variations of its
+// type's colour when it is spawned, and only stores the index. Flattened,
+// the colour of a cell is entry (type << PALETTE_SHADE_BITS) | shade, see
+// colors.h.
+#define PALETTE_SHADE_BITS 4
+#define PALETTE_SHADES (1 << PALETTE_SHADE_BITS)
+extern Color PARTICLE_PALETTE[PT_COUNT][PALETTE_SHADES];
+
+typedef struct Vector2i {
+    int x;
+    int y;
+} Vector2i;
+
+int particle_chance(Particle_Type type);
+
+typedef struct World_Worker World_Worker;
+
+// Update rule of one material, called for every particle of it the sweep
+// visits. Kernels are specialised per set of movement rules at compile time,
+// so the sweep makes one indirect call per cell instead of testing each rule.
+typedef void (*Material_Kernel)(World_Worker *w, size_t x, size_t y);
+
+// Everything that is the same for all particles of one type.
+typedef struct Material_Info {
+    const char *name;
+    Particle_Properties props;
+    // A particle moving down may swap with a lighter liquid or gas, one
+    // moving up with a heavier one.
+    int density;
+    // Cells a liquid may flow sideways in one move, up to WORLD_MAX_SPREAD.
+    int spread_factor;
+    Color color;
+    // One in `chance` cells under the brush spawns a particle.
+    int chance;
+    // NULL for materials that never move, the sweep skips those outright.
+    Material_Kernel update;
+} Material_Info;
+
+extern const Material_Info MATERIALS[PT_COUNT];
+
+// A move queued by the intents engine, as cell indices. Indices do not fit
+// an int in worlds of more than INT_MAX cells.
+typedef struct Particle_Update {
+    size_t src;
+    size_t dst;
+} Particle_Update;
+
+typedef struct Particle_Updates {
+    Particle_Update *items;
+    size_t count;
+    size_t capacity;
+} Particle_Updates;
+
+// The world is split into CHUNK_SIZE x CHUNK_SIZE chunks. Each chunk keeps the
+// rectangle of cells that has to be visited this tick and accumulates the one
+// for the next tick as particles move around in it. A chunk whose next rect
+// stays empty goes to sleep and costs nothing until something wakes it up.
+#define CHUNK_SIZE 32
+
+// How far around a changed cell other particles may react to the change.
+#define CHUNK_DIRTY_MARGIN 2
+
+// Liquids flow at most this far sideways in one move and look one cell
+// further, so a change also wakes the cells that far to either side of it.
+#define WORLD_MAX_SPREAD 8
+static_assert(WORLD_MAX_SPREAD + 1 <= CHUNK_SIZE / 2, "spreading must stay within half a chunk");
+
+// Falling particles gain a cell of velocity per tick up to this. A fall may
+// reach into the next chunk down, but never as far as the chunk after it,
+// which can be updated at the same time in parallel mode.
+#define WORLD_TERMINAL_VELOCITY 12
+static_assert(1 + WORLD_TERMINAL_VELOCITY <= CHUNK_SIZE / 2, "falls must stay within half a chunk");
+
+typedef struct Chunk {
+    // Cells to visit this tick, max is exclusive.
+    int min_x, min_y, max_x, max_y;
+    // Cells to visit next tick, grown by world_wake().
+    int next_min_x, next_min_y, next_max_x, next_max_y;
+    // Cells that may have changed since the renderer last asked, also grown
+    // by world_wake() and reset by world_take_changed_rects().
+    int changed_min_x, changed_min_y, changed_max_x, changed_max_y;
+    // Non-empty cells inside the chunk.
+    size_t population;
+    bool awake;
+} Chunk;
+
+typedef struct World_Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+} World_Rect;
+
+// Counters kept up to date as a side effect of setting and moving particles,
+// reading them never has to look at the grid.
+typedef struct World_Stats {
+    size_t population[PT_COUNT]; // [PT_EMPTY] counts the empty cells
+    size_t particles;            // non-empty cells
+    size_t updates;              // moves attempted during the last tick
+    size_t moved;                // particles moved during the last tick
+    size_t active_chunks;        // chunks awake during the last tick
+    size_t settled;              // particles in chunks asleep during the last tick, as it started
+    size_t ticks;
+    // Filled in by whatever schedules the ticks, see sched.h.
+    size_t skipped_ticks;        // ticks dropped to stay within the catch-up cap
+    size_t merged_ticks;         // wall clock ticks covered by slowed down ticks
+} World_Stats;
+
+typedef struct World World;
+
+typedef enum World_Engine {
+    // Queue every move during the sweep, then shuffle the queue and resolve
+    // it in a second pass.
+    WORLD_ENGINE_INTENTS = 0,
+    // Move particles as soon as the sweep decides to, visiting each row in a
+    // random direction and marking moved particles so they are not moved
+    // again when the sweep reaches them.
+    WORLD_ENGINE_IN_PLACE,
+} World_Engine;
+
+// Per-thread state of a tick: the intents queued while sweeping and the
+// random state used to choose between equally good moves.
+struct World_Worker {
+    World *world;
+    // Reset at the start of every tick. The intents start out with room for
+    // as many as the busiest tick so far, so they rarely have to grow.
+    Arena scratch;
+    Particle_Updates particle_updates;
+    Rng rng;
+
+    size_t updates;
+    size_t moved;
+};
+
+struct World {
+    // The World itself and everything sized by the grid, allocated once by
+    // world_new() from a single region of exactly the size they need. Only
+    // the World when the grid lives in storage given to world_new_in().
+    Arena arena;
+    // Short lived allocations made on the simulation thread, like the chunk
+    // lists of a tick or the spans of a brush stroke, each given back with
+    // arena_rewind() when done.
+    Arena scratch;
+
+    size_t width;
+    size_t height;
+
+    // Particles are stored as parallel arrays of width*height cells. Movement
+    // rules only look at `types`, the rest is only touched by the particle
+    // itself or when it actually moves.
+    uint8_t *types;    // Particle_Type
+    uint8_t *shades;   // index into PARTICLE_PALETTE[type]
+    uint8_t *flags;    // Particle_Flags
+    int8_t *velocity;  // vertical velocity in cells per tick
+
+    // One bit per cell, set when it is not empty, with the 64 cells of a
+    // column in one word so a falling particle finds the next occupied cell
+    // below it a word at a time. The words of a band of 64 rows come one
+    // after another for every column, `column_words` bands in all.
+    uint64_t *columns;
+    size_t column_words;
+    // The same bits stored row by row (`row_words` words per row), and a bit
+    // per cell holding a liquid or gas in the same layout. Sideways movement
+    // rules test 64 neighbours per load, and the sweep skips empty cells a
+    // word at a time.
+    uint64_t *occupied;
+    uint64_t *fluids;
+    size_t row_words;
+
+    // Set when `types` and `shades` point into a private file mapping made
+    // by world_load() instead of being allocated, see snapshot.h.
+    void *mapping;
+    size_t mapping_size;
+
+    size_t chunks_width;
+    size_t chunks_height;
+    Chunk *chunks;
+    // Chunks updated by world_step(), in chunk coordinates with max
+    // exclusive. Set with world_set_region(), the whole world by default.
+    struct { size_t min_x, min_y, max_x, max_y; } region;
+
+    World_Engine engine;
+    // Sweep only the cells that may move, found through the bitmaps above,
+    // instead of every cell of the dirty rects. On by default, the result is
+    // the same either way.
+    bool sweep_occupied;
+
+    // When `parallel` is set, chunks are updated in four checkerboard phases
+    // so that the chunks of one phase never touch the same cells, and each
+    // phase is spread over the worker pool. Otherwise the whole grid is swept
+    // at once by worker 0.
+    bool parallel;
+    // Reseed the random state from (seed, tick, chunk) before every chunk, so
+    // the result does not depend on the thread count or on scheduling.
+    bool deterministic;
+    uint64_t seed;
+    size_t tick;
+    // Random state for everything done from outside the tick (the brush,
+    // spawning particles).
+    Rng rng;
+
+    size_t threads;
+    World_Worker *workers;
+    Pool *pool;
+    // Chunks of the phase being updated, only valid during a tick.
+    size_t *phase_chunks;
+
+    World_Stats stats;
+};
+
+// The world is sized in grid cells, not pixels. Nothing in here touches the
+// window or the GPU; see main.c for how the grid is turned into a texture.
+World *world_new(size_t width, size_t height);
+// Bytes of storage a world of this size needs for its grid.
+size_t world_storage_size(size_t width, size_t height);
+// Same as world_new(), with the grid kept in `storage` instead, which the
+// world does not own. It must be page aligned and either zeroed, or when
+// `reuse` is set hold the grid a world of the same size left there, which
+// is taken over as it is: particles, bitmaps and chunks. The stats are left
+// for the caller to restore.
+World *world_new_in(size_t width, size_t height, void *storage, bool reuse);
+void world_free(World *world);
+// Resize the worker pool used by the parallel mode.
+void world_set_threads(World *world, size_t threads);
+World_Stats world_get_stats(World *world);
+// FNV-1a over the type and shade of every cell, two runs that end with the
+// same checksum ended with the same world.
+uint64_t world_checksum(World *world);
+// Restart every random stream of the world from `seed`. Two worlds with the
+// same seed, the same inputs and the same (or a deterministic) update mode
+// end up identical.
+void world_set_seed(World *world, uint64_t seed);
+// Recount the population of every type and chunk and wake the whole world,
+// for when `types` was replaced wholesale instead of through world_set_type().
+void world_refresh(World *world);
+
+Vector2i world_get_pos(World *world, size_t index);
+size_t world_get_index(World *world, size_t x, size_t y);
+Particle_Type world_get_at_index(World *world, size_t i);
+Particle_Type world_get_at(World *world, size_t x, size_t y);
+Color world_get_color(World *world, size_t i);
+bool world_in_bounds(World *world, size_t x, size_t y);
+bool world_is_empty(World *world, size_t x, size_t y);
+// Replace the particle at (x, y) with a freshly spawned one of `type`.
+void world_set_type(World *world, size_t x, size_t y, Particle_Type type);
+// Exchange two cells, along with everything stored per particle.
+void world_swap(World *world, size_t a, size_t b);
+
+Chunk *world_get_chunk(World *world, size_t x, size_t y);
+// Schedule the cells around (x, y) to be updated on the next tick, waking up
+// any chunk the margin reaches into.
+void world_wake(World *world, size_t x, size_t y);
+// Same for every cell in [x0, x1) x [y0, y1), in one pass over the chunks.
+void world_wake_rect(World *world, int x0, int y0, int x1, int y1);
+// Only update the chunks that overlap `rect` from now on, so a tick costs
+// as much as the region and not the world. Chunks outside of it are frozen
+// as they are, woken or not, until the region covers them again.
+void world_set_region(World *world, World_Rect rect);
+// Write the areas of the region changed since the previous call into
+// `rects`, which must have room for one rect per chunk of the region, and
+// forget about them. Horizontally adjacent changed chunks are merged into
+// one rect.
+size_t world_take_changed_rects(World *world, World_Rect *rects);
+// Copy the colours of `rect` into `pixels`, packed rect.width per row.
+void world_copy_colors(World *world, World_Rect rect, Color *pixels);
+// Same, with every cell drawn as `scale` x `scale` pixels, packed
+// rect.width * scale per row.
+void world_copy_colors_scaled(World *world, World_Rect rect, Color *pixels, size_t scale);
+
+void world_move_particle(World_Worker *w, size_t x_src, size_t y_src, size_t x_dst, size_t y_dst);
+void world_update_particles(World_Worker *w);
+bool world_move_down(World_Worker *w, size_t x, size_t y, bool free_falling);
+bool world_move_down_side(World_Worker *w, size_t x, size_t y);
+bool world_move_side(World_Worker *w, size_t x, size_t y);
+bool world_move_up(World_Worker *w, size_t x, size_t y);
+bool world_move_up_side(World_Worker *w, size_t x, size_t y);
+// Whether a particle of `mover` moving vertically by `dy` can take the place
+// of `target`: always if it is empty, and when sinking into a lighter or
+// rising into a heavier fluid.
+bool world_can_enter(Particle_Type mover, Particle_Type target, int dy);
+
+// Advance the simulation by one physics tick.
+void world_step(World *world);
+
+// Bulk writes to [x0, x1) of row y, for the brush. They keep the counts up
+// to date but do not wake anything, the caller wakes the area it painted.
+//
+// Every empty cell of the span becomes `type` if a random 7 bit value drawn
+// for it is below `threshold`, so 128 fills all of them.
+void world_paint_span(World *world, size_t y, size_t x0, size_t x1, Particle_Type type, uint32_t threshold);
+void world_erase_span(World *world, size_t y, size_t x0, size_t x1);
+
+#endif // WORLD_H_